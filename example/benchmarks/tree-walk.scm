@@ -0,0 +1,32 @@
+;;; Tree walk benchmark.
+;;; Builds a long-lived binary tree of cons cells, then repeatedly
+;;; walks it while allocating short-lived garbage, forcing minor
+;;; collections between walks. Sensitive to the layout of survivors.
+
+(define (make-tree d)
+    (if (= d 0)
+        (cons d '())
+        (cons (make-tree (- d 1)) (make-tree (- d 1)))))
+
+(define (walk t)
+    (if (null? (cdr t))
+        1
+        (+ (walk (car t)) (walk (cdr t)))))
+
+(define (garbage n)
+    (if (= n 0)
+        '()
+        (begin (cons n n) (garbage (- n 1)))))
+
+(define (main depth walks)
+    (let ((tree (make-tree depth)))
+        (do [(i 0 (+ i 1))
+             (c 0 (+ c (walk tree)))]
+            ((= i walks) 
+                (display "walked ")
+                (display c)
+                (display " nodes")
+                (newline))
+            (garbage 10000))))
+
+(main 18 50)
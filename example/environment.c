@@ -22,19 +22,33 @@ int symbol_eqs(R_symbol s1, R_symbol s2) {
 }
 
 static R_environment make_environment(struct type *var_type, R_environment enclosing, int new_literals) {
-    R_environment e = (R_environment)gvmt_malloc(sizeof(GVMT_OBJECT(environment)));
+    R_environment e;
     struct type *t = &type_environment;
+    if (new_literals) {
+        /* Allocate the environment and its literals list in one go */
+        size_t env_size = sizeof(GVMT_OBJECT(environment));
+        size_t cons_size = sizeof(GVMT_OBJECT(cons));
+        GVMT_Object zero = box(0);
+        GVMT_Object region = gvmt_malloc(env_size + 2 * cons_size);
+        R_cons first_item = (R_cons)gvmt_malloc_split(region, env_size);
+        R_cons literals = (R_cons)gvmt_malloc_split(region, env_size + cons_size);
+        first_item->type = &type_cons;
+        first_item->car = zero;
+        first_item->cdr = zero;
+        literals->type = &type_cons;
+        literals->car = (GVMT_Object)first_item;
+        literals->cdr = EMPTY_LIST;
+        e = (R_environment)region;
+        e->literals = literals;
+    } else {
+        e = (R_environment)gvmt_malloc(sizeof(GVMT_OBJECT(environment)));
+        e->literals = enclosing->literals;
+    }
     e->type = t;
     e->enclosing = enclosing;
     e->var_type = var_type;
     e->size = 0;
     e->variables = (R_cons)EMPTY_LIST;
-    if (new_literals) {
-        GVMT_Object first_item;
-        e->literals = make_cons((GVMT_Object)make_cons(box(0), box(0)), EMPTY_LIST);
-    } else {
-        e->literals = enclosing->literals;
-    }
     return e;
 }
 
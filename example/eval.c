@@ -9,6 +9,8 @@
 
 // 64 Megabyte heap space
 #define HEAP_SPACE 1 << 26
+// Calls plus backward jumps before a function is compiled, with -J
+#define TIER_THRESHOLD 1000
 
 uint8_t is_symbol_byte_codes[] = { op(is_symbol), op(return) };
 
@@ -752,7 +754,7 @@ void compile_set_bang(GVMT_Object params, R_environment env, R_bytes b) {
 void compile_apply_function(GVMT_Object o, GVMT_Object params, R_environment env, R_bytes b) {   
     R_function f = (R_function)o;
     struct type *t = f->type;
-    int i;    
+    int i, start;    
     int p_len;
     assert(t == &type_function);
     assert(f->bytecodes[f->length-1] == op(return));
@@ -765,9 +767,12 @@ void compile_apply_function(GVMT_Object o, GVMT_Object params, R_environment env
         wrong_params(params, name, buf);
     }
     expand_compile(params, env, b);
+    start = b->size;
     for (i = 0; i < f->length-1; i++) {
         bytes_append(b, f->bytecodes[i]); 
     }
+    // f may have been interpreted, but b will be optimised before it is.
+    gvmt_remove_superinstructions_interpreter(b->bytes + start, b->bytes + b->size);
 }
 
 /** Lookup symbol, then compile application */
@@ -970,6 +975,8 @@ GVMT_Object init_vm(void) {
     gvmt_malloc_init(HEAP_SPACE);
     recursion_depth = 0;
     recursion_limit = 2000;
+    if (jit_compile == JIT_TIERED)
+        gvmt_tiered_init(TIER_THRESHOLD, gvmt_compile_jit, gvmt_compile_osr);
     init_parser();
     init_lexer(&l, INSTALL_DIR "/lib.scm");
     global_environment = make_top_level_environment();
@@ -1050,13 +1057,38 @@ R_closure insert_tailcalls_then_interpret(R_closure c) {
     R_function f = c->function; 
     while(cleanup(f->bytecodes, f->bytecodes + f->length) != FALSE);
     apply_replacement(f->bytecodes, f->bytecodes + f->length, c);
+    gvmt_superinstructions_interpreter(f->bytecodes, f->bytecodes + f->length);
     c->function->execute = interpret;
-    return interpreter(c->function->bytecodes, c);
+    return interpreter(interpreter_code(c->function), c);
 }
 
 /** Simply interpret */
 R_closure interpret(R_closure c) {
-    return interpreter(c->function->bytecodes, c);   
+    return interpreter(interpreter_code(c->function), c);   
+}
+
+/** Prepare bytecodes, as for insert_tailcalls_then_interpret, then register 
+ * them for compilation in the background. They must not change after this. */
+R_closure register_then_interpret(R_closure c) {
+    char name[100];
+    R_function f = c->function;
+    symbol_to_buffer(f->name, name);
+    while(cleanup(f->bytecodes, f->bytecodes + f->length) != FALSE);
+    apply_replacement(f->bytecodes, f->bytecodes + f->length, c);
+    gvmt_superinstructions_interpreter(f->bytecodes, f->bytecodes + f->length);
+    gvmt_tier_register(f->bytecodes, f->bytecodes + f->length, name);
+    f->execute = interpret_until_compiled;
+    return interpret_until_compiled(c);
+}
+
+/** Interpret, switching to the compiled code once it is ready.
+ * Compiled code is discarded if it deoptimises, so look it up every time. */
+R_closure interpret_until_compiled(R_closure c) {
+    R_function f = c->function; 
+    executable code = gvmt_tier_code(f->bytecodes);
+    if (code)
+        return code(c);
+    return interpreter(interpreter_code(f), c);
 }
 
 /** Interpret once before compiling, 
@@ -1065,7 +1097,28 @@ R_closure interpret_once_then_compile(R_closure c) {
     // TO DO - Fix this.
     // Need to clone bytecodes before compiling.
     c->function->execute = compile_then_run;
-    return interpreter(c->function->bytecodes, c); 
+    return interpreter(interpreter_code(c->function), c); 
+}
+
+#ifdef GVMT_DIRECT_THREADING
+
+/** Threaded code for f, translated on first use. 
+ * Bytecodes must not be modified once translated. 
+ * The code is freed when f is finalised. */
+uintptr_t* interpreter_code(R_function f) {
+    if (f->threaded == NULL) {
+        f->threaded = gvmt_threaded_code_interpreter(f->bytecodes, f->bytecodes + f->length);
+        gvmt_gc_finalizable((GVMT_Object)f);
+    }
+    return f->threaded;
 }
 
+#else
+
+uint8_t* interpreter_code(R_function f) {
+    return f->bytecodes;
+}
+
+#endif
+
 
@@ -117,6 +117,9 @@ GVMT_OBJECT(function) {
     uint8_t* bytecodes;
     int parameters;
     int length;
+#ifdef GVMT_DIRECT_THREADING
+    uintptr_t* threaded;
+#endif
     executable execute;
     R_symbol name;
     R_frame literals;
@@ -200,6 +203,9 @@ extern R_frame globals;
 extern R_environment global_environment;
 extern int print_expression;
 extern int disassemble;
+/* Values of jit_compile, other than 0 (interpret only) */
+#define JIT_ON_FIRST_CALL 1
+#define JIT_TIERED 2
 extern int jit_compile;
 extern int flags_for_lib;
 extern char special_chars[256];
@@ -301,8 +307,20 @@ R_closure interpret(R_closure c);
 R_closure compile_then_run(R_closure c);
 R_closure insert_tailcalls_then_interpret(R_closure c);
 R_closure interpret_once_then_compile(R_closure c);
-
+R_closure register_then_interpret(R_closure c);
+R_closure interpret_until_compiled(R_closure c);
+
+void gvmt_superinstructions_interpreter(uint8_t* start, uint8_t* end);
+void gvmt_remove_superinstructions_interpreter(uint8_t* start, uint8_t* end);
+#ifdef GVMT_DIRECT_THREADING
+/* Interpreter built with gvmtas -D runs threaded code, not bytecodes */
+R_closure interpreter(uintptr_t* code, R_closure c);
+uintptr_t* gvmt_threaded_code_interpreter(uint8_t* start, uint8_t* end);
+uintptr_t* interpreter_code(R_function f);
+#else
 R_closure interpreter(uint8_t* bytecodes, R_closure c);
+uint8_t* interpreter_code(R_function f);
+#endif
 GVMT_Object disassembler(uint8_t* bytes_start, uint8_t* bytes_end, FILE* out);
 void optimise(R_closure c);
 GVMT_Object cleanup(uint8_t* bytes_start, uint8_t* bytes_end);
@@ -35,7 +35,7 @@ extern int test_lexer(void);
 extern signed char fib[];
 int print_expression = 0;
 int disassemble = 0;
-int jit_compile = 1;
+int jit_compile = JIT_ON_FIRST_CALL;
 int flags_for_lib = 0;
 int tracing_on = 0;
 
@@ -53,12 +53,15 @@ int main(int argc, char** argv) {
             tracing_on = 1;
         else if (strcmp(argv[i], "-j") == 0)
             jit_compile = 0;
+        else if (strcmp(argv[i], "-J") == 0)
+            jit_compile = JIT_TIERED;
         else if (strcmp(argv[i], "-h") == 0) {
             printf("-t Turn on tracing\n");
             printf("-h Show this help and exit\n");
             printf("-p Print parser output before evaluating\n");
             printf("-d Print disassembled bytecode before evaluating\n");
             printf("-j No-JIT. Interpreter only\n");
+            printf("-J Tiered. Interpret, compiling hot functions in the background\n");
             printf("-G Show number and times of garbage collection\n");
             return 0;
         } else if (strcmp(argv[i], "-p") == 0)
@@ -86,6 +89,7 @@ int main(int argc, char** argv) {
         printf("%d minor collections in %f ms\n", gvmt_minor_collections, gvmt_minor_collection_time/1000000.0);
         printf("%d major collections in %f ms\n", gvmt_major_collections, gvmt_major_collection_time/1000000.0);
         printf("Total collection time: %f ms\n", gvmt_total_collection_time/1000000.0);
+        printf("Time to safepoint: %f ms\n", gvmt_safepoint_time/1000000.0);
     }
     return 0;
 }
@@ -133,9 +133,14 @@ GVMT_Object make_function(R_symbol name, int parameters, uint8_t* bytecodes, int
     f->parameters = parameters;
     f->bytecodes = bytecodes;
     f->length = length;
+#ifdef GVMT_DIRECT_THREADING
+    f->threaded = NULL;
+#endif
     f->name = name;
     f->literals = literals;
-    if (jit_compile)
+    if (jit_compile == JIT_TIERED)
+        f->execute = register_then_interpret;
+    else if (jit_compile)
         f->execute = compile_then_run;
     else
         f->execute = insert_tailcalls_then_interpret;
@@ -145,7 +150,7 @@ GVMT_Object make_function(R_symbol name, int parameters, uint8_t* bytecodes, int
 /** As above, just takes a char* rather than a string as a name */
 GVMT_Object make_function_c(char* name, int parameters, uint8_t* bytecodes, int length, R_frame literals) {
     GVMT_Object f = make_function(symbol_from_c_string(name), parameters, bytecodes, length, literals);
-    if (jit_compile)
+    if (jit_compile == JIT_ON_FIRST_CALL)
         ((R_function)f)->execute = compile_then_run;
     return f;
 }
@@ -114,7 +114,11 @@ struct type type_environment = {
 };
 
 struct type type_function = {
+#ifdef GVMT_DIRECT_THREADING
+    -6,
+#else
     -5,
+#endif
     2,
     0,
     "function",
@@ -604,7 +608,7 @@ GVMT_Object execute(R_bytes code, R_frame literals) {
     GVMT_Object result;
     bytes_append(code, op(return));  
     c = make_closure((R_function)make_function(symbol_from_c_string(""), 0, code->bytes, code->size, literals), 0);
-    c = interpreter(code->bytes, c);
+    c = interpreter(interpreter_code(c->function), c);
     while (c) {
         c = c->function->execute(c);
     }
@@ -646,9 +650,16 @@ GVMT_Object interpreter_trace(uint8_t* ip) {
     return 0;
 }
 
-/* Finalization - Should never be called. */
+/* Finalization - Only functions with threaded code are finalizable. */
 void user_finalise_object(GVMT_Object o) {
+#ifdef GVMT_DIRECT_THREADING
+    R_function f = (R_function)o;
+    assert(f->type == &type_function);
+    free(f->threaded);
+    f->threaded = NULL;
+#else
     abort();
+#endif
 }
 
 // Marshalling support. Do not require marshalling, 
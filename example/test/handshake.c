@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "gvmt/native.h"
+#include "gvmt/internal/core.h"
+
+/** Handshake test, compile with the native C compiler.
+ * Requests a handshake of every thread while the finalizer thread is idle,
+ * parked waiting for a collection that never comes.
+ * Fails by timing out if the handshake is never run. */
+
+/* Minimal GC callbacks. This test allocates nothing. */
+GVMT_CALL int* gvmt_user_shape(GVMT_Object obj, int* buffer) {
+    abort();
+    return buffer;
+}
+
+GVMT_CALL GVMT_StackItem* user_finalise_object(GVMT_StackItem* sp, GVMT_Frame fp) {
+    return sp + 1;
+}
+
+GVMT_CALL GVMT_StackItem* gvmt_user_uncaught_exception(GVMT_StackItem* sp, GVMT_Frame fp) {
+    fprintf(stderr, "Uncaught exception\n");
+    exit(1);
+    return sp;
+}
+
+void user_gc_out_of_memory(void) {
+    exit(1);
+}
+
+static volatile int32_t handshakes = 0;
+
+static void count(int32_t thread_id, void* arg) {
+    __sync_fetch_and_add((volatile int32_t*)arg, 1);
+}
+
+static int result = 1;
+
+GVMT_CALL GVMT_StackItem* test(GVMT_StackItem* sp, GVMT_Frame fp) {
+    gvmt_enter_native(sp, fp);
+    // Give the finalizer thread time to park.
+    usleep(100000);
+    gvmt_handshake_all(count, (void*)&handshakes);
+    sp = gvmt_exit_native();
+    if (handshakes == 1) {
+        printf("Handshake with idle finalizer: OK\n");
+        result = 0;
+    } else {
+        printf("Handshake with idle finalizer: ran %d times\n", handshakes);
+    }
+    return sp;
+}
+
+int main(int argc, char** argv) {
+    GVMT_MAX_SHAPE_SIZE = 4;
+    // A hung handshake kills the test.
+    alarm(10);
+    gvmt_start_machine(1 << 16, (gvmt_func_ptr)test, 0);
+    return result;
+}
@@ -8,15 +8,25 @@ void gvmt_do_collection() {
     GenCopy::collect();
 }
 
+#ifdef GVMT_PREZERO_NURSERY
+static char gencopy2_name[] = "gencopy2_prezero";
+#else
 static char gencopy2_name[] = "gencopy2";
+#endif
 
 extern "C" {
 
     char* gvmt_gc_name = &gencopy2_name[0];
    
+#ifdef GVMT_PREZERO_NURSERY
+    GVMT_Object gvmt_gencopy2_prezero_malloc(GVMT_StackItem* sp, GVMT_Frame fp, size_t size) {
+        return GenCopy::allocate(sp, fp, size);
+    }
+#else
     GVMT_Object gvmt_gencopy2_malloc(GVMT_StackItem* sp, GVMT_Frame fp, size_t size) {
         return GenCopy::allocate(sp, fp, size);
     }
+#endif
 
     GVMT_CALL GVMT_Object gvmt_fast_allocate(size_t size) {
         return GenCopy::fast_allocate(size);
@@ -32,6 +42,15 @@ extern "C" {
         return GenCopy::pin(obj);
     }
     
+    GVMT_LINKAGE_1(gvmt_gc_unpin, void* obj)
+        GenCopy::unpin((GVMT_Object)obj);
+        GVMT_RETURN_V;
+    }
+    
+    GVMT_LINKAGE_1(gvmt_malloc_pinned, void* size)
+        GVMT_RETURN_R(GenCopy::allocate_pinned(gvmt_sp, fp, (size_t)size));
+    }
+    
     int gvmt_is_pinned(void* ptr) {
         return GenCopy::is_pinned(ptr);
     }
@@ -8,15 +8,25 @@ void gvmt_do_collection() {
     GenImmix::collect();
 }
 
+#ifdef GVMT_PREZERO_NURSERY
+static char genimmix2_name[] = "genimmix2_prezero";
+#else
 static char genimmix2_name[] = "genimmix2";
+#endif
 
 extern "C" {
 
     char* gvmt_gc_name = &genimmix2_name[0];
    
+#ifdef GVMT_PREZERO_NURSERY
+    GVMT_Object gvmt_genimmix2_prezero_malloc(GVMT_StackItem* sp, GVMT_Frame fp, size_t size) {
+        return GenImmix::allocate(sp, fp, size);
+    }
+#else
     GVMT_Object gvmt_genimmix2_malloc(GVMT_StackItem* sp, GVMT_Frame fp, size_t size) {
         return GenImmix::allocate(sp, fp, size);
     }
+#endif
 
     GVMT_CALL GVMT_Object gvmt_fast_allocate(size_t size) {
         return GenImmix::fast_allocate(size);
@@ -37,6 +47,15 @@ extern "C" {
         return GenImmix::pin(obj);
     }
     
+    GVMT_LINKAGE_1(gvmt_gc_unpin, void* obj)
+        GenImmix::unpin((GVMT_Object)obj);
+        GVMT_RETURN_V;
+    }
+    
+    GVMT_LINKAGE_1(gvmt_malloc_pinned, void* size)
+        GVMT_RETURN_R(GenImmix::allocate_pinned(gvmt_sp, fp, (size_t)size));
+    }
+    
     int gvmt_is_pinned(void* ptr) {
         return GenImmix::is_pinned(ptr);
     }
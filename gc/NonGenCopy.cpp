@@ -31,6 +31,15 @@ extern "C" {
         return NonGenCopy::pin(obj);
     }
     
+    GVMT_LINKAGE_1(gvmt_gc_unpin, void* obj)
+        (void)obj;
+        GVMT_RETURN_V;
+    }
+    
+    GVMT_LINKAGE_1(gvmt_malloc_pinned, void* size)
+        GVMT_RETURN_R(NonGenCopy::allocate_pinned(gvmt_sp, fp, (size_t)size));
+    }
+    
 }
 
 
@@ -1,5 +1,8 @@
 
 #include "gvmt/internal/memory.hpp"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 void Block::clear_modified_map() {
     Zone* z = Zone::containing(this);
@@ -12,6 +15,25 @@ void Block::clear_modified_map() {
     }
 }
 
+/** Zeroes the whole block. Uses non-temporal stores where available, 
+ * so that zeroing the nursery does not flush the cache. */
+void Block::zero() {
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i* ptr = reinterpret_cast<__m128i*>(this);
+    __m128i* end = reinterpret_cast<__m128i*>(this->next());
+    for (; ptr < end; ptr += 4) {
+        _mm_stream_si128(ptr, zero);
+        _mm_stream_si128(ptr+1, zero);
+        _mm_stream_si128(ptr+2, zero);
+        _mm_stream_si128(ptr+3, zero);
+    }
+    _mm_sfence();
+#else
+    memset(reinterpret_cast<void*>(this), 0, Block::size);
+#endif
+}
+
 /** These are posix specific, will need new version for MS Windows */ 
 
 char* OS::get_new_mmap_region(uintptr_t size) {
@@ -235,6 +257,7 @@ namespace GC {
     std::vector<Block*> mark_stack_blocks;
     Address* mark_stack_pointer = 0;
     Block* mark_stack_reserve = 0;
+    int copy_depth = 0;
        
 }
 
@@ -2130,6 +2130,10 @@ static void emit_subtree(Node p) {
                 intrinsic("GC_MALLOC ");
                 return;
             }
+            if (strcmp(name, "malloc_split") == 0) {
+                intrinsic("GC_SPLIT ");
+                return;
+            }
             if (strncmp(name, "push_", 5) == 0) {
                 if (name[5] == 'x' && name[6] == 0) {
                     intrinsic("DROP ");
@@ -2247,6 +2251,18 @@ static void emit_subtree(Node p) {
                 intrinsic("FAR_JUMP ");
                 return;
             }
+            if (strcmp(name, "quicken") == 0) {
+                intrinsic("QUICKEN ");
+                return;
+            }
+            if (strcmp(name, "inline_cache") == 0) {
+                intrinsic("INLINE_CACHE ");
+                return;
+            }
+            if (strcmp(name, "feedback") == 0) {
+                intrinsic("FEEDBACK ");
+                return;
+            }
             if (strcmp(name, "fully_initialized") == 0) {
                 intrinsic("FULLY_INITIALIZED ");
                 return;
@@ -8,6 +8,36 @@ void gvmt_compile(uint8_t* begin, uint8_t* end, char* name);
 
 void* gvmt_compile_jit(uint8_t* begin, uint8_t* end, char* name);
 
+/** Compiles bytecodes from begin to end, entered at entry, which must be the
+ * start of an instruction, with the stack and locals of an interpreter
+ * running the same bytecodes. For on-stack replacement. */
+void* gvmt_compile_osr(uint8_t* begin, uint8_t* end, uint8_t* entry, char* name);
+
 void gvmt_write_ir(void);
 
+/** Tiered compilation, for interpreters built with gvmtas -J.
+ * Starts a background thread that compiles hot bytecodes with compile,
+ * usually gvmt_compile_jit. Bytecodes are hot once the interpreter has
+ * been entered at their start, or jumped backwards in them, threshold times.
+ * $GVMT_TIER_THRESHOLD, if set, overrides threshold.
+ * Hot loops are compiled with compile_osr, usually gvmt_compile_osr, 
+ * so that the interpreter can continue running them in compiled code.
+ * If compile_osr is NULL, there is no on-stack replacement. */
+void gvmt_tiered_init(uint32_t threshold, 
+                      void* (*compile)(uint8_t* begin, uint8_t* end, char* name),
+                      void* (*compile_osr)(uint8_t* begin, uint8_t* end, 
+                                           uint8_t* entry, char* name));
+
+/** Registers the bytecodes from begin to end for tiered compilation.
+ * They may be compiled at any time, so must not be modified after this,
+ * other than by quickening. With on-stack replacement, a loop must not 
+ * jump back to its header while an exception handler pushed since the
+ * start of the bytecodes is active. */
+void gvmt_tier_register(uint8_t* begin, uint8_t* end, char* name);
+
+/** Returns the compiled code for the bytecodes registered at begin,
+ * or NULL if they have not (yet) been compiled. Code that deoptimises is 
+ * discarded, so this may return NULL again, then different code. */
+void* gvmt_tier_code(uint8_t* begin);
+
 #endif
@@ -15,6 +15,17 @@
 /** Allocate s bytes of memory on the heap */
 GVMT_Object gvmt_malloc(size_t s);
 
+/** Regions allocated for splitting must be smaller than this, 
+ * so that they are never placed in the large object space. */
+#define GVMT_MAX_REGION_SIZE 1024
+
+/** Intrinsic for GC_SPLIT.
+ * Returns the object offset bytes into region, which must have been
+ * allocated by gvmt_malloc() since the last GC-safe point. 
+ * Allows several objects to be allocated with a single gvmt_malloc(). 
+ * Offsets must be multiples of sizeof(void*). */
+GVMT_Object gvmt_malloc_split(GVMT_Object region, size_t offset);
+
 /* Initialise the heap and GC.
  * Size is a (soft) limit on the maximum heap size.
  * Must be called before gvmt_malloc() or GC-related functions are called. */
@@ -111,6 +122,39 @@ uintptr_t gvmt_fetch4(void);
  * Continues interpretation from bytecode at address. */
 void gvmt_far_jump(uint8_t* address);
 
+/** Intrinsic for QUICKEN, only valid in interpreter.
+ * Replaces the opcode of the current instruction, in the bytecode. */
+void gvmt_quicken(int opcode);
+
+/** Rewrites the current instruction to name, which must be declared with 
+ * the quick qualifier. In a quickened instruction, GVMT_DEQUICKEN() 
+ * restores its inputs and the original instruction, then re-executes it. */
+#define GVMT_QUICKEN(name) gvmt_quicken(_gvmt_quick_##name)
+
+/** Intrinsic for INLINE_CACHE.
+ * Returns the pointer at offset in key, recording key in an inline cache
+ * of up to ways keys for this site. */
+void* gvmt_inline_cache(void* key, int offset, int ways);
+
+/** Returns key->member, where key is usually the type of an object.
+ * Only for instructions with the cache(n) qualifier, which caches up to
+ * n keys. key->member must never change. Keys are compared by address,
+ * and compiled code embeds them as constants, so a key must never move nor
+ * be freed. Under a copying or compacting collector, a key in the heap must
+ * be allocated with gvmt_malloc_pinned() and kept alive by a root. */
+#define GVMT_INLINE_CACHE(key, type, member) \
+gvmt_inline_cache((void*)(key), offsetof(type, member), _gvmt_cache_ways)
+
+/** Intrinsic for FEEDBACK.
+ * Returns value, recording it in the feedback vector of the current function,
+ * at the current instruction. */
+uintptr_t gvmt_feedback(uintptr_t value);
+
+/** Returns x, usually a type or a tag, as a uintptr_t. Tiered interpreters
+ * record it for the compiler, which specialises code on x if it was the only
+ * value recorded here, deoptimising if it sees another. */
+#define GVMT_FEEDBACK(x) gvmt_feedback((uintptr_t)(x))
+
 /** Sets the (thread-local) tracing state to s. */
 void gvmt_set_tracing(int s);
 
@@ -182,8 +226,10 @@ void gvmt_gc_free_weak_reference(void* ref);
 #define gvmt_gc_read_weak_reference gvmt_gc_read_root
 
 /* Write to a weak reference. Will be NULL if the object has been reclaimed, 
- * otherwise it will be the object originally used to create the weak reference */ 
-#define gvmt_gc_write_weak_reference gvmt_gc_write_root
+ * otherwise it will be the object originally used to create the weak reference.
+ * Weak references must only be written with this, so that minor collections
+ * can find those that may refer to young objects. */ 
+void gvmt_gc_write_weak_reference(void* ref, GVMT_Object obj);
 
 /* Add a root to the GC root set and initialize it with NULL.
  * The root can be set to NULL or any other object. The object referred to 
@@ -196,6 +242,18 @@ void* gvmt_gc_add_root(void);
  */
 void* gvmt_pin(GVMT_Object obj);
 
+/* Allocates an object that will never be moved by the GC,
+ * so it can be passed to native code without pinning. 
+ * Prefer this to gvmt_pin() for objects known to be long-lived buffers.
+ */
+GVMT_Object gvmt_malloc_pinned(size_t size);
+
+/* Releases a pin made by gvmt_pin(). The object may move at the next 
+ * collection, so pointers returned by gvmt_pin() must not be used after this.
+ * Objects allocated by gvmt_malloc_pinned() are not affected.
+ */
+void gvmt_gc_unpin(void* obj);
+
 /* Treat an address as an object. Must only be applied to objects which
  * have been pinned AND have a root preventing them from being collected.
  */ 
@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <map>
+#include <set>
 #include "gvmt/internal/gc_templates.hpp"
 #include "gvmt/internal/gc_threads.hpp"
 #include "gvmt/internal/memory.hpp"
 #include "gvmt/internal/LargeObjectSpace.hpp"
+#include "gvmt/internal/PinnedSpace.hpp"
 
 #define MB ((unsigned)(1024*1024))
 
@@ -20,6 +23,16 @@ class Nursery {
     static std::vector<Block*> blocks;
     static std::vector<Block*> pinned;
     static size_t next_free_block_index;
+    /** Objects pinned in each pinned block, once for each pin, protected
+     * by pin_lock.
+     * A block whose objects have all been unpinned by the next minor
+     * collection goes back into the nursery, rather than being promoted. */
+    static std::map<Block*, std::multiset<GVMT_Object> > pinned_objects;
+    static pthread_mutex_t pin_lock;
+#ifdef GVMT_PREZERO_NURSERY
+    /** Blocks back from pinning, to be zeroed once evacuated */
+    static std::vector<Block*> released;
+#endif
     
     static Block* get_block_synchronised() {
         size_t block_index;
@@ -65,6 +78,9 @@ public:
     }
     
     static void add_block(Block* b) {
+#ifdef GVMT_PREZERO_NURSERY
+        b->zero();
+#endif
         int index = Zone::index_of<Block>(b);
         Zone::containing(b)->collector_block_data[index] = blocks.size();
         b->set_space(Space::NURSERY);
@@ -83,6 +99,7 @@ public:
     
     static void pin(Block* b) {
         assert(b->space() == Space::PINNED);
+        pthread_mutex_lock(&pin_lock);
         b->set_pinned(true);
         assert(find(blocks.begin(), blocks.end(), b) != blocks.end());
         int index = Zone::index_of<Block>(b);
@@ -96,9 +113,77 @@ public:
         pinned.push_back(b);
         assert(find(blocks.begin(), blocks.end(), b) == blocks.end());
         sanity();
+        pthread_mutex_unlock(&pin_lock);
+    }
+    
+    static void record_pin(Block* b, GVMT_Object obj) {
+        pthread_mutex_lock(&pin_lock);
+        pinned_objects[b].insert(obj);
+        pthread_mutex_unlock(&pin_lock);
+    }
+    
+    static void unpin(GVMT_Object obj) {
+        pthread_mutex_lock(&pin_lock);
+        std::map<Block*, std::multiset<GVMT_Object> >::iterator it;
+        it = pinned_objects.find(Block::containing(obj));
+        if (it != pinned_objects.end()) {
+            // Objects may be pinned more than once, remove one pin only.
+            std::multiset<GVMT_Object>::iterator pin = it->second.find(obj);
+            if (pin != it->second.end())
+                it->second.erase(pin);
+        }
+        pthread_mutex_unlock(&pin_lock);
+    }
+    
+    /** Return pinned blocks with nothing left pinned to the nursery,
+     * so their objects are evacuated as normal. 
+     * Called with the world stopped, before a minor collection. */
+    static void release_unpinned_blocks() {
+        size_t i = 0;
+        while (i < pinned.size()) {
+            Block* b = pinned[i];
+            std::map<Block*, std::multiset<GVMT_Object> >::iterator it;
+            it = pinned_objects.find(b);
+            if (it == pinned_objects.end() || !it->second.empty()) {
+                i++;
+                continue;
+            }
+            pinned_objects.erase(it);
+            pinned[i] = pinned.back();
+            pinned.pop_back();
+            b->set_pinned(false);
+            Zone* z = Zone::containing(b);
+            memset(&z->pinned[Zone::index_of<Line>(Address(b))], 0, Block::size/Line::size);
+            int index = Zone::index_of<Block>(b);
+            z->collector_block_data[index] = blocks.size();
+            b->set_space(Space::NURSERY);
+            blocks.push_back(b);
+#ifdef GVMT_PREZERO_NURSERY
+            released.push_back(b);
+#endif
+        }
+        sanity();
     }
     
+#ifdef GVMT_PREZERO_NURSERY
+    /** Zero all blocks handed out since the last collection.
+     * Blocks beyond next_free_block_index are untouched, so still zero. */
+    static void zero_used_blocks() {
+        size_t used = std::min(next_free_block_index, blocks.size());
+        for (size_t i = 0; i < used; i++) {
+            blocks[i]->zero();
+        }
+    }
+#endif
+    
     static void clear() {
+#ifdef GVMT_PREZERO_NURSERY
+        zero_used_blocks();
+        for (size_t i = 0; i < released.size(); i++) {
+            released[i]->zero();
+        }
+        released.clear();
+#endif
         next_free_block_index = 0;
         allocator::zero_limit_pointers();
     }
@@ -150,6 +235,7 @@ public:
             sanity();
         }
         sanity();
+        pinned_objects.clear();
         gvmt_nursery_size -= Block::size * size;
         return size;
     }
@@ -159,12 +245,20 @@ public:
 size_t Nursery::next_free_block_index = 0;
 std::vector<Block*> Nursery::blocks;
 std::vector<Block*> Nursery::pinned;
+std::map<Block*, std::multiset<GVMT_Object> > Nursery::pinned_objects;
+pthread_mutex_t Nursery::pin_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifdef GVMT_PREZERO_NURSERY
+std::vector<Block*> Nursery::released;
+#endif
 
 template <class Policy> class MajorCollection {
 public:
     
     typedef Policy policy;
     
+    static const bool skip_clean_frames = false;
+    static const bool young_only = false;
+    
     static inline bool wants(GVMT_Object p) {
         return gc::is_address(p);
     }
@@ -199,6 +293,10 @@ public:
     
     typedef Policy policy;
     
+    /** Frames scanned since last written hold no young references */
+    static const bool skip_clean_frames = true;
+    static const bool young_only = true;
+    
     static inline bool wants(GVMT_Object p) {
         assert (!gc::is_address(p) || Block::containing(p)->space() != Space::PINNED);
         return gc::is_address(p) && Space::is_young(Address(p));
@@ -206,7 +304,7 @@ public:
     
     static inline GVMT_Object apply(GVMT_Object p) {
         assert(gc::is_address(p));
-        return Memory::copy<Policy>(Address(p));
+        return Memory::hierarchical_copy<MinorCollection<Policy> >(Address(p));
     }
     
     static inline bool is_live(Address p) {
@@ -223,6 +321,9 @@ public:
     
     typedef Policy policy;
     
+    static const bool skip_clean_frames = true;
+    static const bool young_only = true;
+    
     static inline bool wants(GVMT_Object p) {
         return gc::is_address(p) && Space::is_young(Address(p));
     }
@@ -237,7 +338,7 @@ public:
             }
             return p;
         } else {
-            return Memory::copy<Policy>(Address(p));
+            return Memory::hierarchical_copy<MinorCollectionWithPinning<Policy> >(Address(p));
         }
     }
     
@@ -295,6 +396,28 @@ public:
             }
             assert (mem != NULL);
         }
+#ifdef GVMT_PREZERO_NURSERY
+        // Nursery memory is already zeroed, large object blocks may not be.
+        if (size >= LARGE_OBJECT_SIZE) {
+            memset(reinterpret_cast<void*>(mem), 0, size);
+        }
+#endif
+        return mem;
+    }
+    
+    /** Allocate an object that will never move, doing GC if necessary */
+    static inline GVMT_Object allocate_pinned(GVMT_StackItem* sp, GVMT_Frame fp,
+                                              size_t size) {
+        // Large objects never move.
+        if (!PinnedSpace::can_allocate(size))
+            return allocate(sp, fp, size);
+        GVMT_Object mem = PinnedSpace::allocate(size, false);
+        if (mem == NULL) {
+            mutator::request_gc();
+            mutator::wait_for_collector(sp, fp);
+            mem = PinnedSpace::allocate(size, true);
+            assert (mem != NULL);
+        }
         return mem;
     }
     
@@ -307,6 +430,7 @@ public:
         Heap::ensure_space(std::max(gvmt_nursery_size, 4*MB));
         GC::weak_references.intialise();
         LargeObjectSpace::init();
+        PinnedSpace::init();
         mutator::init();
         collector::init();
         finalizer::init();
@@ -326,6 +450,7 @@ public:
                     Nursery::pin(Block::containing(obj));
                 }
                 z->pinned[Zone::index_of<Line>(Address(obj))] = 1;
+                Nursery::record_pin(Block::containing(obj), obj);
                 assert(Block::containing(obj)->space() == Space::PINNED); 
             } else {
                 if (space == Space::MATURE) {
@@ -337,11 +462,20 @@ public:
             }
         } else {
             z->pinned[Zone::index_of<Line>(Address(obj))] = 1;
+            Nursery::record_pin(Block::containing(obj), obj);
         }
         assert(is_pinned(obj));
         return reinterpret_cast<void*>(obj);
     }
     
+    /** Called by mutator code to release a pin.
+     * A nursery block is freed to move once all its objects are unpinned.
+     * Objects outside the nursery stay put. */
+    static inline void unpin(GVMT_Object obj) {
+        if (gc::is_address(obj) && Space::is_young(Address(obj)))
+            Nursery::unpin(obj);
+    }
+    
     static int is_pinned(void* ptr) {
         if (gc::is_tagged(ptr)) {
             // Pinned means ptr is unmodifiable by GC.
@@ -380,11 +514,13 @@ public:
         }
         LargeObjectSpace::process_old_young<C>();
         HugeObjectSpace::process_old_young<C>();
+        PinnedSpace::process_old_young<C>();
     }
     
     static void minor_collect() {        
         int64_t t0, t1;
         t0 = high_res_time();
+        Nursery::release_unpinned_blocks();
         if (Nursery::any_pinned()) {
             gc::process_roots<MinorCollectionWithPinning<Policy> >();
             process_old_young<MinorCollectionWithPinning<Policy> >();
@@ -419,6 +555,7 @@ public:
         Policy::pre_collection();
         LargeObjectSpace::pre_collection();
         HugeObjectSpace::pre_collection();
+        PinnedSpace::pre_collection();
         gc::process_roots<MajorCollection<Policy> >();
         gc::transitive_closure<MajorCollection<Policy> >();
         gc::process_finalisers<MajorCollection<Policy> >();
@@ -426,6 +563,7 @@ public:
         gc::process_weak_refs<MajorCollection<Policy> >();
         LargeObjectSpace::sweep();
         HugeObjectSpace::sweep();
+        PinnedSpace::sweep();
         Policy::reclaim();
         Heap::done_collection();
         assert(GC::mark_stack_is_empty());
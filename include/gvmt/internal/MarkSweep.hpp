@@ -67,9 +67,9 @@ public:
             assert(b->space() == Space::LARGE);
             Address ptr = b->start();
             do {
-                if (ptr.read_word() == 0)
-                    break;
-                assert(gvmt_user_length(ptr.as_object()) <= size);
+                // Unmarked cells are free, and hold a free-list link.
+                if (Zone::marked(ptr))
+                    assert(gvmt_user_length(ptr.as_object()) <= size);
                 ptr = ptr.plus_bytes(size);
             } while (b->contains(ptr, size));
         }
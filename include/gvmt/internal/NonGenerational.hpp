@@ -4,11 +4,15 @@
 #include "gvmt/internal/gc_threads.hpp"
 #include "gvmt/internal/memory.hpp"
 #include "gvmt/internal/LargeObjectSpace.hpp"
+#include "gvmt/internal/PinnedSpace.hpp"
 
 #define MB ((unsigned)(1024*1024))
 
 template <class Policy> class NonGenCollection {
 public:
+    
+    static const bool skip_clean_frames = false;
+    static const bool young_only = false;
          
     static inline bool wants(GVMT_Object p) {
         return gc::is_address(p);
@@ -66,12 +70,29 @@ public:
         return (GVMT_Object)mem;
     }
     
+    /** Allocate an object that will never move, doing GC if necessary */
+    static inline GVMT_Object allocate_pinned(GVMT_StackItem* sp, GVMT_Frame fp,
+                                              size_t size) {
+        // Large objects never move.
+        if (!PinnedSpace::can_allocate(size))
+            return allocate(sp, fp, size);
+        GVMT_Object mem = PinnedSpace::allocate(size, false);
+        if (mem == NULL) {
+            mutator::request_gc();
+            mutator::wait_for_collector(sp, fp);
+            mem = PinnedSpace::allocate(size, true);
+            assert (mem != NULL);
+        }
+        return mem;
+    }
+    
     static inline void init(size_t heap_size_hint) {
         Policy::init(heap_size_hint);
         Heap::init<Policy>();
         Heap::ensure_space(4 * MB);
         GC::weak_references.intialise();    
         LargeObjectSpace::init();
+        PinnedSpace::init();
         mutator::init();
         collector::init();
         finalizer::init();
@@ -88,6 +109,7 @@ public:
         Policy::pre_collection();
         LargeObjectSpace::pre_collection();
         HugeObjectSpace::pre_collection();
+        PinnedSpace::pre_collection();
         gc::process_roots<NonGenCollection<Policy> >();
         gc::transitive_closure<NonGenCollection<Policy> >();
         gc::process_finalisers<NonGenCollection<Policy> >();
@@ -95,6 +117,7 @@ public:
         gc::process_weak_refs<NonGenCollection<Policy> >();
         LargeObjectSpace::sweep();
         HugeObjectSpace::sweep();
+        PinnedSpace::sweep();
         Policy::reclaim();
         Heap::done_collection();
         allocator::zero_limit_pointers();
@@ -0,0 +1,105 @@
+#ifndef GVMT_INTERNAL_PINNED_SPACE_H
+#define GVMT_INTERNAL_PINNED_SPACE_H
+
+#include <string.h>
+#include <pthread.h>
+#include "gvmt/internal/memory.hpp"
+#include "gvmt/internal/MarkSweep.hpp"
+
+/** The Pinned Space holds small objects allocated by gvmt_malloc_pinned(),
+ * which are never moved. (Larger ones go in the Large Object Space.)
+ * Objects are allocated from size-class mark-sweep lists, in blocks of their
+ * own, so pinned allocation never takes blocks out of the nursery.
+ * Blocks are tagged Space::LARGE, so collections treat pinned objects as
+ * large objects: never young, and marked in place by major collections.
+ * An object is marked from allocation until the next major collection.
+ * Objects allocated since the last collection are scanned in full by
+ * the next minor collection, as they may have been initialised without
+ * a write barrier.
+ */
+class PinnedSpace {
+
+    static const int LOG_MIN_SIZE = 4;
+    /** Size classes are powers of two, up to LARGE_OBJECT_SIZE */
+    static const int CLASSES = Block::log_size - LOG_MIN_SIZE;
+
+    static MarkSweepList lists[CLASSES];
+    static std::vector<GVMT_Object> young_objects;
+    static pthread_mutex_t lock;
+
+    static inline int size_class(size_t size) {
+        int c = 0;
+        while (((size_t)1 << (LOG_MIN_SIZE + c)) < size)
+            c++;
+        assert(c < CLASSES);
+        return c;
+    }
+
+public:
+
+    static inline bool can_allocate(size_t size) {
+        return size < LARGE_OBJECT_SIZE;
+    }
+
+    static void init() {
+        for (int i = 0; i < CLASSES; i++) {
+            lists[i].init(1 << (LOG_MIN_SIZE + i));
+        }
+    }
+
+    /** Returns a zeroed object, or NULL if a new block is needed and
+     * none is available without force */
+    static GVMT_Object allocate(size_t size, bool force) {
+        assert(can_allocate(size));
+        size_t asize = align(size);
+        MarkSweepList& list = lists[size_class(asize)];
+        pthread_mutex_lock(&lock);
+        GVMT_Object result = list.allocate();
+        if (result == NULL) {
+            Block* b = Heap::get_block(Space::LARGE, force);
+            if (b != NULL) {
+                list.add_block(b);
+                result = list.allocate();
+            }
+        }
+        if (result != NULL)
+            young_objects.push_back(result);
+        pthread_mutex_unlock(&lock);
+        if (result != NULL)
+            memset(reinterpret_cast<void*>(result), 0, asize);
+        return result;
+    }
+
+    template <class Collection> static void process_old_young() {
+        for (int i = 0; i < CLASSES; i++) {
+            lists[i].process_old_young<Collection>();
+        }
+        std::vector<GVMT_Object>::iterator it;
+        for (it = young_objects.begin(); it != young_objects.end(); it++) {
+            char* object = reinterpret_cast<char*>(*it);
+            gc::scan_object<Collection>(object);
+            Zone::containing(object)->clear_modified(Line::containing(object));
+        }
+        young_objects.clear();
+    }
+
+    static void pre_collection() {
+        young_objects.clear();
+        for (int i = 0; i < CLASSES; i++) {
+            lists[i].pre_collection();
+        }
+    }
+
+    static void sweep() {
+        for (int i = 0; i < CLASSES; i++) {
+            lists[i].sweep();
+        }
+    }
+
+};
+
+MarkSweepList PinnedSpace::lists[PinnedSpace::CLASSES];
+std::vector<GVMT_Object> PinnedSpace::young_objects;
+pthread_mutex_t PinnedSpace::lock = PTHREAD_MUTEX_INITIALIZER;
+
+#endif // GVMT_INTERNAL_PINNED_SPACE_H
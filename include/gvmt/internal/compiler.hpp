@@ -13,6 +13,7 @@
 #include <llvm/Support/IRBuilder.h>
 #include "llvm/CallingConv.h"
 #include "llvm/ExecutionEngine/JIT.h"
+#include <pthread.h>
 #include <map>
 #include <deque>
 #include <utility>
@@ -54,6 +55,9 @@ class CompilerStack {
     void max_join_depth(unsigned max, llvm::BasicBlock* bb);
     llvm::Value* get_pointer(llvm::BasicBlock* bb);
     void store_pointer(llvm::Value* ptr, llvm::BasicBlock* bb);
+    /** Copies the top count items, and any cached items, into items, top first.
+     * Returns where the top item would be, were the stack flushed. */
+    llvm::Value* snapshot(unsigned count, std::vector<llvm::Value*>& items, llvm::BasicBlock* bb);
 };
 
 class Architecture {
@@ -88,6 +92,18 @@ class Architecture {
 // Toolkit generated class
 class Globals;
 
+/** An inline cache site, as the compiler sees it:
+ * the keys recorded there by the interpreter, with their targets. */
+struct InlineCache {
+    llvm::Value* key;
+    int offset;
+    /** Number of keys, or GVMT_MEGAMORPHIC */
+    int count;
+    void* keys[GVMT_CACHE_WAYS];
+    void* targets[GVMT_CACHE_WAYS];
+    InlineCache(uint8_t* ip, llvm::Value* key, int offset);
+};
+
 class BaseCompiler {
     
     inline bool is_jit(void) { return jitting; }
@@ -130,11 +146,51 @@ class BaseCompiler {
     llvm::Value *FRAME;
     uint8_t *IP;
     uint8_t *ip_start;
+    uint8_t *ip_end;
     std::map<int, llvm::BasicBlock*> block_map;
     bool jitting;
     Globals *globals;
     int stack_cache_size;
+    /** Offset of the loop header entered from the interpreter, or -1 */
+    int osr_offset;
+    /** Pops the interpreter's frame, for an OSR entry */
+    llvm::Value* osr_frame(void);
+    /** Copies the local at offset in the interpreter's frame, which is laid
+     * out by the C compiler, to its slot laddr in FRAME. */
+    void osr_local(llvm::Value* interpreter_frame, unsigned int offset, 
+                   llvm::Value* laddr, const llvm::Type* type);
+    /** Interpreter entry for deoptimisation, or NULL if it has none */
+    gvmt_funcptr deopt_interpreter;
+    /** Start of the instruction that may deoptimise, or NULL.
+     * Cleared at anything that may collect garbage, which may move objects
+     * held in deopt_items, and at any store, lock, pin or native call, 
+     * which the re-executed instruction would repeat. */
+    uint8_t* deopt_ip;
+    llvm::Value* deopt_sp;
+    std::vector<llvm::Value*> deopt_items;
+    /** Saves the stack, including the instruction's inputs, 
+     * so that the instruction can deoptimise. Only when jitting. */
+    void deopt_point(int inputs);
+    /** Terminates bb with a call to the interpreter, which re-executes the 
+     * instruction at deopt_ip with the saved stack and the locals in FRAME, 
+     * and returns its result. */
+    void deoptimise(llvm::BasicBlock* bb);
     void emit_print(int x, llvm::BasicBlock* bb);
+    /** Loads the target from the key of cache */
+    llvm::Value* cached_target(InlineCache& cache, llvm::BasicBlock* bb);
+    /** Calls the target of cache. Targets recorded by the interpreter are
+     * called directly, guarded by a test of the key. If the instruction can
+     * deoptimise, other keys deoptimise rather than call indirectly. 
+     * If native, each call is made in native mode, after the guards, 
+     * so that deoptimisation happens in managed mode.
+     * Changes current_block. */
+    llvm::Value* cached_call(InlineCache& cache, const llvm::PointerType* func_type,
+                             unsigned cc, llvm::Value** args, llvm::Value** args_end,
+                             bool native = false);
+    /** Returns value, or the only value the interpreter recorded for this
+     * instruction, if it can deoptimise when value differs. 
+     * Changes current_block. */
+    llvm::Value* feedback(llvm::Value* value);
   public:
     static llvm::Value* save_and_restore(llvm::Value* from, 
                             const llvm::Type* to, llvm::BasicBlock* bb);
@@ -67,9 +67,20 @@ struct gvmt_frame {
     struct gvmt_frame* previous;
 //    intptr_t ip;
     uintptr_t count;
+    /* GVMT_FRAME_DIRTY, GVMT_FRAME_CLEAN or GVMT_FRAME_ALWAYS_SCAN */
+    uintptr_t scanned;
     GVMT_Object refs[0];
 };
 
+/* Compiled code sets scanned to DIRTY whenever it writes a reference into
+ * the frame. The GC sets DIRTY frames to CLEAN once it has scanned them,
+ * after which they hold no young references until next written, so minor
+ * collections can skip them. Frames whose references may be written by
+ * other means (address taken, JIT-compiled code) are ALWAYS_SCAN. */
+#define GVMT_FRAME_DIRTY 0
+#define GVMT_FRAME_CLEAN 1
+#define GVMT_FRAME_ALWAYS_SCAN 2
+
 typedef GVMT_CALL 
 GVMT_StackItem* (*gvmt_funcptr)(GVMT_StackItem* sp, GVMT_Frame fp);
 
@@ -114,7 +125,12 @@ void gvmt_pop_and_free_handler(void);
 #define GVMT_RETURN_R(x) gvmt_sp[-1].o = (GVMT_Object)(x); return gvmt_sp-1;
 #define GVMT_RETURN_V return gvmt_sp;
 
+/** Non-zero if threads should take the safe point slow path. 
+ * Compiled code only tests for non-zero; the GC tests the bits. */
 extern int8_t gvmt_gc_waiting;
+#define GVMT_WAITING_GC 1
+#define GVMT_WAITING_HANDSHAKE 2
+extern char* gvmt_gc_poll_page;
 void gvmt_gc_safe_point(GVMT_StackItem* sp, GVMT_Frame fp);
 
 extern void* _gvmt_global_symbols;
@@ -153,6 +169,229 @@ int gvmt_is_pinned(void* ptr);
 
 GVMT_CALL void gvmt_save_pointers(GVMT_StackItem* sp, GVMT_Frame fp);
 
+/** Called before each instruction by interpreters built with gvmtas -S.
+ * next is the address of the instruction that follows in the bytecode */
+void gvmt_profile_sequence(void* ip, void* next, int opcode, char** names);
+
+/** Per-thread opcode profile, for interpreters built with gvmtas -Q.
+ * Pairs are opcodes executed one after the other by the same thread.
+ * Cycles are counted from the start of one instruction to the start of the
+ * next, so include dispatch and, for calls, the time spent in the callee. */
+struct gvmt_opcode_profile {
+    uint64_t counts[256];
+    /** Index 256 is for the time before the first instruction */
+    uint64_t cycles[257];
+    uint64_t last_cycles;
+    int previous;
+    uint64_t pairs[257][256];
+    struct gvmt_opcode_profile* next;
+};
+
+extern GVMT_THREAD_LOCAL struct gvmt_opcode_profile* gvmt_opcode_profile;
+
+/** Creates the profile for the current thread. */
+struct gvmt_opcode_profile* gvmt_opcode_profile_start(char** names);
+
+#define GVMT_COUNT_OPCODE(profile, opcode) do { \
+    (profile)->counts[opcode]++; \
+    (profile)->pairs[(profile)->previous][opcode]++; \
+    (profile)->previous = (opcode); \
+} while (0)
+
+#define GVMT_TIME_OPCODE(profile) do { \
+    uint64_t _gvmt_now = gvmt_cycle_count(); \
+    (profile)->cycles[(profile)->previous] += _gvmt_now - (profile)->last_cycles; \
+    (profile)->last_cycles = _gvmt_now; \
+} while (0)
+
+/** Inline caches, for GVMT_INLINE_CACHE.
+ * A site is an instruction address and the offset of the target in the key.
+ * Each site records up to GVMT_CACHE_WAYS keys, with their targets, for the
+ * compiler. Sites share a fixed-size table, so may evict each other. */
+#define GVMT_CACHE_WAYS 4
+#define GVMT_INLINE_CACHES (1 << 12)
+/** Count of a site that has seen more keys than it may record */
+#define GVMT_MEGAMORPHIC -1
+
+struct gvmt_inline_cache {
+    void* ip;
+    intptr_t offset;
+    int count;
+    void* keys[GVMT_CACHE_WAYS];
+    void* targets[GVMT_CACHE_WAYS];
+};
+
+extern struct gvmt_inline_cache gvmt_inline_caches[GVMT_INLINE_CACHES];
+
+#define GVMT_INLINE_CACHE_INDEX(ip, offset) \
+    ((((uintptr_t)(ip)) * 31 + (offset)) & (GVMT_INLINE_CACHES - 1))
+
+/** Records key, and its target, at the site. */
+void gvmt_inline_cache_miss(void* ip, void* key, intptr_t offset, int ways);
+
+/** Copies the keys and targets recorded at the site.
+ * Returns the number of keys, or GVMT_MEGAMORPHIC. */
+int gvmt_inline_cache_read(void* ip, intptr_t offset, void** keys, void** targets);
+
+/** Returns the target, the pointer at offset in key, recording key in
+ * the inline cache for the site, unless it is already there.
+ * The table is read without locking, so the target is always loaded from
+ * the key; a stale read can only cause an unnecessary miss. */
+static inline void* gvmt_inline_cache_lookup(void* ip, void* key, intptr_t offset, int ways) {
+    struct gvmt_inline_cache* cache = &gvmt_inline_caches[GVMT_INLINE_CACHE_INDEX(ip, offset)];
+    int i;
+    if (cache->ip == ip && cache->offset == offset) {
+        for (i = 0; i < ways; i++) {
+            if (cache->keys[i] == key)
+                return *(void**)(((char*)key) + offset);
+        }
+        if (cache->count == GVMT_MEGAMORPHIC)
+            return *(void**)(((char*)key) + offset);
+    }
+    gvmt_inline_cache_miss(ip, key, offset, ways);
+    return *(void**)(((char*)key) + offset);
+}
+
+/** Tiered compilation, for interpreters built with gvmtas -J.
+ * Each registered block of bytecodes has a counter, incremented whenever
+ * the interpreter is entered at its start, and on each backward jump.
+ * Once it reaches the threshold, the block is queued for compilation.
+ * A backward jump that finds the count over the threshold also requests an
+ * entry point at its target, for on-stack replacement (OSR). The next time
+ * the interpreter takes that jump, it continues in the compiled code.
+ * Compiled code that deoptimises is discarded, to be recompiled once hot.
+ * Tiers are never freed, so may be read without locking. */
+#define GVMT_TIER_INTERPRETED 0
+#define GVMT_TIER_QUEUED 1
+#define GVMT_TIER_COMPILED 2
+
+struct gvmt_tier {
+    uint8_t* begin;
+    uint8_t* end;
+    char* name;
+    uint32_t count;
+    int state;
+    /** Compiled code, NULL until compiled */
+    void* volatile code;
+    /** Loop header of the OSR entry point, NULL until requested */
+    uint8_t* osr_ip;
+    int osr_state;
+    /** Compiled code entered at osr_ip, NULL until compiled */
+    gvmt_funcptr volatile osr_code;
+    /** Whether the tier is in the compilation queue */
+    int queued;
+    /** Number of times compiled code has deoptimised */
+    uint32_t deopts;
+    /** Feedback, indexed by offset from begin, NULL until first recorded */
+    struct gvmt_feedback* volatile feedback;
+    /** Next tier in the same bucket */
+    struct gvmt_tier* chain;
+    /** Next tier in the compilation queue */
+    struct gvmt_tier* next;
+};
+
+#define GVMT_TIERS (1 << 12)
+
+extern struct gvmt_tier* volatile gvmt_tiers[GVMT_TIERS];
+
+extern uint32_t gvmt_tier_threshold;
+
+#define GVMT_TIER_INDEX(ip) ((((uintptr_t)(ip)) >> 2) & (GVMT_TIERS - 1))
+
+/** Queues tier for the compiler thread, unless already queued.
+ * If osr_ip is not NULL, also requests an OSR entry point there. */
+void gvmt_tier_hot(struct gvmt_tier* tier, uint8_t* osr_ip);
+
+#define GVMT_TIER_COUNT(tier) do { \
+    if (++(tier)->count >= gvmt_tier_threshold && \
+        (tier)->state == GVMT_TIER_INTERPRETED) \
+        gvmt_tier_hot(tier, NULL); \
+} while (0)
+
+/** Counts a backward jump to target. */
+#define GVMT_TIER_BACK_EDGE(tier, target) do { \
+    if (++(tier)->count >= gvmt_tier_threshold && \
+        ((tier)->state == GVMT_TIER_INTERPRETED || (tier)->osr_ip == NULL)) \
+        gvmt_tier_hot(tier, target); \
+} while (0)
+
+/** Returns the OSR entry point for a jump to target, or NULL.
+ * It must be called with the interpreter frame on top of the stack, and
+ * the caller of the interpreter's frame, and returns as the interpreter. */
+#define GVMT_TIER_OSR_CODE(tier, target) \
+    ((tier)->osr_ip == (target) ? (tier)->osr_code : NULL)
+
+/** After this many deoptimisations, bytecodes are compiled without 
+ * speculating, and the code is no longer discarded. */
+#define GVMT_TIER_MAX_DEOPTS 8
+
+/** Returns the tier for bytecodes starting at ip, or NULL. */
+static inline struct gvmt_tier* gvmt_tier_lookup(void* ip) {
+    struct gvmt_tier* tier = gvmt_tiers[GVMT_TIER_INDEX(ip)];
+    while (tier && tier->begin != ip)
+        tier = tier->chain;
+    return tier;
+}
+
+/** Counts an entry to the interpreter at ip. Returns the tier, or NULL. */
+static inline struct gvmt_tier* gvmt_tier_enter(void* ip) {
+    struct gvmt_tier* tier = gvmt_tier_lookup(ip);
+    if (tier)
+        GVMT_TIER_COUNT(tier);
+    return tier;
+}
+
+/** Type feedback, for GVMT_FEEDBACK.
+ * A registered block gets a feedback vector when the interpreter first
+ * records a value in it, with an entry for each bytecode offset.
+ * An entry holds the first value recorded, until another is recorded.
+ * Entries are not locked; a stale read by the compiler can only make
+ * compiled code deoptimise. */
+#define GVMT_FEEDBACK_NONE 0
+#define GVMT_FEEDBACK_MONOMORPHIC 1
+#define GVMT_FEEDBACK_POLYMORPHIC 2
+
+struct gvmt_feedback {
+    uintptr_t value;
+    int state;
+};
+
+/** Returns the feedback vector of tier, allocating it if necessary. */
+struct gvmt_feedback* gvmt_feedback_vector(struct gvmt_tier* tier);
+
+/** Reads the feedback at ip, in the block registered at begin.
+ * Returns the state, setting *value if GVMT_FEEDBACK_MONOMORPHIC. */
+int gvmt_feedback_read(uint8_t* begin, uint8_t* ip, uintptr_t* value);
+
+/** Called by the interpreter when compiled code for the bytecodes 
+ * registered at begin deoptimises at ip. Marks the feedback at ip as 
+ * polymorphic, and discards the compiled code. Returns the tier, or NULL. */
+struct gvmt_tier* gvmt_tier_deoptimise(uint8_t* begin, uint8_t* ip);
+
+/** Records value at ip, for tier, which may be NULL. Returns value. */
+static inline uintptr_t gvmt_feedback_record(struct gvmt_tier* tier, uint8_t* ip, uintptr_t value) {
+    struct gvmt_feedback* entry;
+    uintptr_t offset;
+    if (tier == NULL)
+        return value;
+    // A far jump may have left the block.
+    offset = ip - tier->begin;
+    if (offset >= (uintptr_t)(tier->end - tier->begin))
+        return value;
+    entry = tier->feedback;
+    if (entry == NULL)
+        entry = gvmt_feedback_vector(tier);
+    entry += offset;
+    if (entry->state == GVMT_FEEDBACK_NONE) {
+        entry->value = value;
+        __sync_synchronize();
+        entry->state = GVMT_FEEDBACK_MONOMORPHIC;
+    } else if (entry->state == GVMT_FEEDBACK_MONOMORPHIC && entry->value != value) {
+        entry->state = GVMT_FEEDBACK_POLYMORPHIC;
+    }
+    return value;
+}
+
 #define RETURN_TYPE_V  1
 #define RETURN_TYPE_I4 2
 #define RETURN_TYPE_I8 3
@@ -5,11 +5,25 @@
 #include <inttypes.h>
 #include <assert.h>
 #include "stdio.h"
+#include <string.h>
 #include <deque>
 #include <vector>
 
 #define FORWARDING_BIT 1
 
+/* Objects up to this many words are copied with unrolled code,
+ * larger ones with memcpy. */
+#define GVMT_SMALL_COPY_WORDS 8
+
+/* If defined, objects of at least this many bytes are copied with 
+ * non-temporal stores, which do not pollute the cache. 
+ * Only worth doing for objects copied to fresh memory. Requires SSE2. */
+//#define GVMT_NON_TEMPORAL_COPY 512
+
+#if defined(GVMT_NON_TEMPORAL_COPY) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 inline size_t align(uintptr_t size) {
     return ((size+(sizeof(void*)-1))&(-(sizeof(void*))));
 }
@@ -137,6 +151,61 @@ namespace gc {
     }
 
 #endif
+
+    /** Unrolled copy of N words */
+    template <int N> struct CopyWords {
+        static inline void copy(uintptr_t* to, uintptr_t* from) {
+            CopyWords<N-1>::copy(to, from);
+            to[N-1] = from[N-1];
+        }
+    };
+    
+    template <> struct CopyWords<0> {
+        static inline void copy(uintptr_t* to, uintptr_t* from) {
+        }
+    };
+    
+#if defined(GVMT_NON_TEMPORAL_COPY) && defined(__SSE2__)
+    
+    inline void non_temporal_copy(void* to, void* from, size_t size) {
+        int* to_ptr = reinterpret_cast<int*>(to);
+        int* from_ptr = reinterpret_cast<int*>(from);
+        for (size_t i = 0; i < size / sizeof(int); i++) {
+            _mm_stream_si32(to_ptr + i, from_ptr[i]);
+        }
+        _mm_sfence();
+    }
+    
+#endif
+    
+    /** Copies size bytes from -> to. size must be a multiple of the word size.
+     * Small objects are copied by an unrolled sequence specific to their size,
+     * larger ones by memcpy (or non-temporal stores, if enabled). */
+    inline void copy_object(Address from, Address to, size_t size) {
+        uintptr_t* to_ptr = reinterpret_cast<uintptr_t*>(to.bits());
+        uintptr_t* from_ptr = reinterpret_cast<uintptr_t*>(from.bits());
+        switch (size / sizeof(void*)) {
+        case 1: CopyWords<1>::copy(to_ptr, from_ptr); return;
+        case 2: CopyWords<2>::copy(to_ptr, from_ptr); return;
+        case 3: CopyWords<3>::copy(to_ptr, from_ptr); return;
+        case 4: CopyWords<4>::copy(to_ptr, from_ptr); return;
+        case 5: CopyWords<5>::copy(to_ptr, from_ptr); return;
+        case 6: CopyWords<6>::copy(to_ptr, from_ptr); return;
+        case 7: CopyWords<7>::copy(to_ptr, from_ptr); return;
+        case GVMT_SMALL_COPY_WORDS: 
+            CopyWords<GVMT_SMALL_COPY_WORDS>::copy(to_ptr, from_ptr); 
+            return;
+        default:
+#if defined(GVMT_NON_TEMPORAL_COPY) && defined(__SSE2__)
+            if (size >= GVMT_NON_TEMPORAL_COPY) {
+                non_temporal_copy(to_ptr, from_ptr, size);
+                return;
+            }
+#endif
+            memcpy(to_ptr, from_ptr, size);
+        }
+    }
+    
 };
 
 namespace object {
@@ -238,6 +307,7 @@ namespace Root {
         GVMT_Object* start;
         GVMT_Object* end;
         Block *next;
+        Block *previous;
     };
     
     Block* allocateBlock();
@@ -259,6 +329,7 @@ namespace Root {
                     temp = allocateBlock();
                 end_reference = temp->start;
                 last->next = temp;
+                temp->previous = last;
                 last = temp;
             }
             GVMT_Object *result = end_reference;
@@ -266,6 +337,18 @@ namespace Root {
             ++end_reference;
             return result;
         }     
+        
+        /** Appends a whole block of slots, for the caller to hand out.
+         * The GC sees all of it, so unused slots must be kept NULL.
+         * A list that hands out blocks must not also use addRoot or free. */
+        Block* addBlock() {
+            Block* b = allocateBlock();
+            last->next = b;
+            b->previous = last;
+            last = b;
+            end_reference = b->end;
+            return b;
+        }
     
         class iterator {  
             GVMT_Object* root;
@@ -315,11 +398,8 @@ namespace Root {
             if (end_reference == last->start) {
                 // Final block is empty.
                 // Update last and end_reference.
-                Block* b = first;
-                assert(b != last);
-                while (b->next != last)
-                    b = b->next;
-                last = b;               
+                assert(last != first);
+                last = last->previous;
                 end_reference = last->end;
             }
             --end_reference;
@@ -398,6 +478,10 @@ public:
         return iterator(*top_frame_pointer_addr);
     } 
     
+    inline struct gvmt_frame* top() {
+        return *top_frame_pointer_addr;
+    }
+    
     inline iterator end() { 
         return iterator(NULL);
     }
@@ -456,6 +540,59 @@ class Stack {
 
 }; 
 
+/** Candidate reference slots in one thread's stack and frames, found by
+ * the thread itself just before parking for a collection, so that stacks are
+ * walked in parallel rather than by the collector. Only valid while the 
+ * thread remains parked. 
+ * Clean frames are recorded, not scanned, as minor collections skip them. */
+class ScannedRoots {
+    
+public:
+    
+    bool valid;
+    std::vector<GVMT_Object*> slots;
+    std::vector<struct gvmt_frame*> clean_frames;
+    std::vector<struct gvmt_frame*> dirty_frames;
+    
+    ScannedRoots() : valid(false) {
+    }
+    
+    inline void scan(Stack stack, FrameStack frames) {
+        slots.clear();
+        clean_frames.clear();
+        dirty_frames.clear();
+        for (struct gvmt_frame* f = frames.top(); f; f = f->previous) {
+            if (f->scanned == GVMT_FRAME_CLEAN) {
+                clean_frames.push_back(f);
+                continue;
+            }
+            if (f->scanned == GVMT_FRAME_DIRTY)
+                dirty_frames.push_back(f);
+            for (uintptr_t i = 0; i < f->count; i++) {
+                if (gc::is_address(f->refs[i]))
+                    slots.push_back(&f->refs[i]);
+            }
+        }
+        for (Stack::iterator it = stack.begin(), 
+                             end = stack.end(); it != end; ++it) {
+            if (gc::is_address(*it))
+                slots.push_back(&*it);
+        }
+        valid = true;
+    }
+    
+    typedef std::vector<GVMT_Object*>::iterator iterator;
+
+    inline iterator begin() {
+        return slots.begin();
+    }
+    
+    inline iterator end() {
+        return slots.end();
+    }
+
+};
+
 extern "C" size_t size_from_shape(int* shape);
 
 namespace GC {
@@ -463,8 +600,16 @@ namespace GC {
     extern std::deque<GVMT_Object> finalization_queue;
     extern std::vector<Stack> stacks;
     extern std::vector<FrameStack> frames;
-    extern std::deque<GVMT_Object> finalizables;
+    /** Indexed as stacks and frames; may be shorter. */
+    extern std::vector<ScannedRoots*> scanned_roots;
+    /** Finalizable objects registered since the last collection */
+    extern std::vector<GVMT_Object> finalizables;
+    /** Finalizable objects that have survived a collection, so are old */
+    extern std::vector<GVMT_Object> old_finalizables;
     extern Root::List weak_references;
+    /** Weak references written since the last collection.
+     * Only these can refer to young objects. */
+    extern std::vector<GVMT_Object*> young_weak_references;
 
 };
 
@@ -554,23 +699,23 @@ template <class Collector> class VM {
     
     
     template <class Policy> inline void process_finalisers(Policy policy) {
-        int n = GC::finalizables.size();
-        for(int i = 0; i < n; i++) {
-            GVMT_Object obj = GC::finalizables.back();
-            GC::finalizables.pop_back();
+        std::vector<GVMT_Object>& old = GC::old_finalizables;
+        old.insert(old.end(), GC::finalizables.begin(), GC::finalizables.end());
+        GC::finalizables.clear();
+        size_t kept = 0;
+        for (size_t i = 0; i < old.size(); i++) {
+            GVMT_Object obj = old[i];
             if (policy.applies(obj)) {
                 obj = policy.apply(obj);
-                if (policy.is_live(obj)) {
-                    GC::finalizables.push_front(obj);
-                } else {
+                if (!policy.is_live(obj)) {
                     // obj is not live, so it needs to be finalized
-                    // Keep live, add to finalization Q, then remove from finalizables.
                     GC::finalization_queue.push_front(obj);
+                    continue;
                 }
-            } else {
-                GC::finalizables.push_front(obj);  
             }
+            old[kept++] = obj;
         }
+        old.resize(kept);
     }
     
     template <class Policy> inline void process_weak_refs(Policy policy) {
@@ -585,6 +730,7 @@ template <class Collector> class VM {
                 }
             }
         }
+        GC::young_weak_references.clear();
     }
   
 };
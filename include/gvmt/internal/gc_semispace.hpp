@@ -22,34 +22,10 @@ namespace semispace {
     }
     
     inline GVMT_Object move(GVMT_Object from) {
-        int shape_buffer[16];
-        int* shape = gvmt_user_shape((GVMT_Object)from, shape_buffer);
-        int len =  0;
+        size_t size = align(gvmt_user_length(from));
         Address to = Address(free);
-        Address real_from = Address(from);
-        while (*shape) {
-            if (*shape < 0)
-                len -= *shape++;
-            else 
-                len += *shape++;
-        }
-        size_t size = len * sizeof(void*);
-        free = free + align(size);
-        Address to_ptr, from_ptr;
-        to_ptr = to;
-        from_ptr = real_from;
-        // Copy first word - All objects are word aligned 
-        // and must use some memory, so it is always safe to copy first word
-        to_ptr.write_word(from_ptr.read_word()); 
-        to_ptr = to_ptr.next_word();
-        if (to_ptr < Address(free)) {
-            from_ptr = from_ptr.next_word();
-            do {
-                to_ptr.write_word(from_ptr.read_word()); 
-                to_ptr = to_ptr.next_word();
-                from_ptr = from_ptr.next_word();
-            } while (to_ptr < Address(free));
-        }
+        free = free + size;
+        gc::copy_object(Address(from), to, size);
         set_forwarding_address(from, to);
         return to.as_object();
     }
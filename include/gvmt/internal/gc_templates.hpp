@@ -5,26 +5,68 @@
 
 namespace gc {
         
+    template <class Collection> inline void process_frame(struct gvmt_frame* f) {
+        for (uintptr_t i = 0; i < f->count; i++) {
+            if (Collection::wants(f->refs[i]))
+                f->refs[i] = Collection::apply(f->refs[i]);
+        }
+    }
+    
+    inline void mark_clean(struct gvmt_frame* f) {
+        if (f->scanned == GVMT_FRAME_DIRTY)
+            f->scanned = GVMT_FRAME_CLEAN;
+    }
+    
+    template <class Collection> inline void process_frames(FrameStack& frames) {
+        for (struct gvmt_frame* f = frames.top(); f; f = f->previous) {
+            if (Collection::skip_clean_frames && f->scanned == GVMT_FRAME_CLEAN)
+                continue;
+            process_frame<Collection>(f);
+            mark_clean(f);
+        }
+    }
+    
+    template <class Collection> inline void process_scanned_roots(ScannedRoots* roots) {
+        for (ScannedRoots::iterator it = roots->begin(), 
+                                    end = roots->end(); it != end; ++it) {
+            if (Collection::wants(**it))
+                **it = Collection::apply(**it);
+        }
+        std::vector<struct gvmt_frame*>::iterator it;
+        if (!Collection::skip_clean_frames) {
+            for (it = roots->clean_frames.begin(); it != roots->clean_frames.end(); ++it)
+                process_frame<Collection>(*it);
+        }
+        for (it = roots->dirty_frames.begin(); it != roots->dirty_frames.end(); ++it)
+            mark_clean(*it);
+    }
+    
+    inline bool was_scanned(size_t index) {
+        return index < GC::scanned_roots.size() && GC::scanned_roots[index]->valid;
+    }
+        
     template <class Collection> inline void process_roots() {
         for (Root::List::iterator it = Root::GC_ROOTS.begin(), 
                                   end = Root::GC_ROOTS.end(); it != end; ++it) {
             if (Collection::wants(*it))
                 *it = Collection::apply(*it);
         }
-        for (std::vector<FrameStack>::iterator it = GC::frames.begin(),
-                          end = GC::frames.end(); it != end; ++it) {
-            for (FrameStack::iterator it2 = it->begin(), 
-                                  end2 = it->end(); it2 != end2; ++it2) {
-                if (Collection::wants(*it2))
-                    *it2 = Collection::apply(*it2);
-            }
+        // Threads that scanned their own stacks (and frames) before parking.
+        for (size_t i = 0; i < GC::scanned_roots.size(); i++) {
+            if (was_scanned(i))
+                process_scanned_roots<Collection>(GC::scanned_roots[i]);
+        }
+        for (size_t i = 0; i < GC::frames.size(); i++) {
+            if (!was_scanned(i))
+                process_frames<Collection>(GC::frames[i]);
         } 
-        for (std::vector<Stack>::iterator it = GC::stacks.begin(),
-                          end = GC::stacks.end(); it != end; ++it) {
-            for (Stack::iterator it2 = it->begin(),
-                                 end2 = it->end(); it2 != end2; ++it2) {
-                if (Collection::wants(*it2))
-                    *it2 = Collection::apply(*it2);
+        for (size_t i = 0; i < GC::stacks.size(); i++) {
+            if (was_scanned(i))
+                continue;
+            for (Stack::iterator it = GC::stacks[i].begin(),
+                                 end = GC::stacks[i].end(); it != end; ++it) {
+                if (Collection::wants(*it))
+                    *it = Collection::apply(*it);
             }
         }
         for (std::deque<GVMT_Object>::iterator it = GC::finalization_queue.begin(), 
@@ -34,39 +76,66 @@ namespace gc {
         }
     }
     
-    template <class Collection> inline void process_finalisers() {
-        int n = GC::finalizables.size();
-        for(int i = 0; i < n; i++) {
-            GVMT_Object obj = GC::finalizables.back();
-            GC::finalizables.pop_back();
+    /** Process finalizables from index start of v, in place.
+     * Survivors are kept, in order, and dead objects queued for finalization */
+    template <class Collection> inline void 
+    partition_finalizables(std::vector<GVMT_Object>& v, size_t start) {
+        size_t kept = start;
+        for (size_t i = start; i < v.size(); i++) {
+            GVMT_Object obj = v[i];
             if (Collection::wants(obj)) {
-                if (Collection::is_live(Address(obj))) {
-                    obj = Collection::apply(obj);
-                    GC::finalizables.push_front(obj);
-                } else {
-                    // obj is not live, so it needs to be finalized
-                    // Keep live, add to finalization Q, then remove from finalizables.
-                    obj = Collection::apply(obj);
+                bool live = Collection::is_live(Address(obj));
+                // Keep live, even if it is to be finalized.
+                obj = Collection::apply(obj);
+                if (!live) {
                     GC::finalization_queue.push_front(obj);
+                    continue;
                 }
-            } else {
-                GC::finalizables.push_front(obj);  
             }
+            v[kept++] = obj;
         }
+        v.resize(kept);
+    }
+    
+    /** Surviving finalizables are old after any collection, so move to
+     * GC::old_finalizables. Young-only collections leave those alone. */
+    template <class Collection> inline void process_finalisers() {
+        std::vector<GVMT_Object>& old = GC::old_finalizables;
+        if (!Collection::young_only)
+            partition_finalizables<Collection>(old, 0);
+        size_t start = old.size();
+        old.insert(old.end(), GC::finalizables.begin(), GC::finalizables.end());
+        GC::finalizables.clear();
+        partition_finalizables<Collection>(old, start);
     }    
     
+    template <class Collection> inline void process_weak_ref(GVMT_Object& ref) {
+        // If ref is not live then zero it.
+        if (Collection::wants(ref)) {  
+            if (Collection::is_live(Address(ref))) {
+                ref = Collection::apply(ref);
+            } else {
+                ref = 0;
+            }
+        }
+    }
+    
+    /** Young-only collections need only visit weak references written 
+     * since the last collection; after it, all referents are old. */
     template <class Collection> inline void process_weak_refs() {
-        for (Root::List::iterator it = GC::weak_references.begin(), 
-                           end = GC::weak_references.end(); it != end; ++it) {
-            // If *it is not live then zero it.
-            if (Collection::wants(*it)) {  
-                if (Collection::is_live(Address(*it))) {
-                    *it = Collection::apply(*it);
-                } else {
-                    *it = 0;
-                }
+        if (Collection::young_only) {
+            std::vector<GVMT_Object*>::iterator it;
+            for (it = GC::young_weak_references.begin(); 
+                 it != GC::young_weak_references.end(); ++it) {
+                process_weak_ref<Collection>(**it);
+            }
+        } else {
+            for (Root::List::iterator it = GC::weak_references.begin(), 
+                               end = GC::weak_references.end(); it != end; ++it) {
+                process_weak_ref<Collection>(*it);
             }
         }
+        GC::young_weak_references.clear();
     }
     
 //Should refactor this, to allow custom scanners for different VMs.
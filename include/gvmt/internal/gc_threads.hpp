@@ -21,6 +21,10 @@ namespace mutator {
     
     void init();
 
+    inline bool gc_requested(void) {
+        return gvmt_gc_waiting & GVMT_WAITING_GC;
+    }
+
     void wait_for_collector(GVMT_StackItem* sp, GVMT_Frame fp);
     
     void request_gc();
@@ -29,6 +33,13 @@ namespace mutator {
 
 #define GVMT_ALLOCATOR_BLOCK_SIZE (1<<14)
 #define GVMT_ALLOCATOR_PAGE_SIZE (1<<12)
+/** Largest thread-local chunk, before capping by free space */
+#define GVMT_ALLOCATOR_MAX_CHUNK_SIZE (1<<20)
+/** A thread's chunk size doubles after this many refills in one GC interval */
+#define GVMT_ALLOCATOR_GROW_REFILLS 4
+/** Size of the chunks that per-CPU caches take from the shared space */
+#define GVMT_ALLOCATOR_CPU_CHUNK_SIZE (1<<18)
+#define GVMT_ALLOCATOR_MAX_CPUS 64
     
 namespace allocator {
 
@@ -38,7 +49,52 @@ namespace allocator {
     extern char* free;
     extern char* limit;
     
+    /** Allocation statistics of one thread. Also used to size its chunks.
+     * Only the owning thread writes these, except at collections. */
+    struct Stats {
+        int32_t thread_id;
+        /** Size of the next chunk this thread takes, in bytes */
+        int chunk_size;
+        /** Chunks taken since the last resize */
+        int refills;
+        /** Totals since the thread started */
+        uint64_t bytes;
+        uint64_t chunks;
+        /** Bytes taken since the last collection */
+        uint64_t interval_bytes;
+        /** Rate over the last complete interval, in bytes per second */
+        uint64_t rate;
+    };
+    
+    extern GVMT_THREAD_LOCAL Stats stats;
+    extern std::vector<Stats*> thread_stats;
+    /** Upper bound on chunk sizes, recomputed each collection */
+    extern int max_chunk_size;
+    
     char* get_block(GVMT_StackItem* sp, GVMT_Frame fp, int size);    
+    
+    /** Take a new chunk, at least size bytes, for this thread */
+    inline char* get_chunk(GVMT_StackItem* sp, GVMT_Frame fp, int size) {
+        // Threads that keep running out get bigger chunks.
+        if (++stats.refills >= GVMT_ALLOCATOR_GROW_REFILLS) {
+            stats.refills = 0;
+            if (stats.chunk_size*2 <= max_chunk_size)
+                stats.chunk_size *= 2;
+        }
+        int chunk_size = (size+stats.chunk_size-1) & 
+                         (~(GVMT_ALLOCATOR_PAGE_SIZE-1));
+        char* chunk = get_block(sp, fp, chunk_size);
+        gvmt_gc_free_pointer = (GVMT_StackItem*)chunk;
+        gvmt_gc_limit_pointer = (GVMT_StackItem*)(chunk + chunk_size);
+        stats.bytes += chunk_size;
+        stats.chunks++;
+        stats.interval_bytes += chunk_size;
+        return chunk;
+    }
+    
+    /** Adapt chunk sizes, update rates and empty the per-CPU caches.
+     * Called with the world stopped, at the end of each collection. */
+    void end_interval(void);
 
     inline void* bump_pointer_alloc(int asize) {
         char* next = ((char*)gvmt_gc_free_pointer);
@@ -53,20 +109,16 @@ namespace allocator {
             return bump_pointer_alloc(asize);
         }
         // Run out of thread memory.
-        if (gvmt_gc_waiting) {
+        if (mutator::gc_requested()) {
             mutator::wait_for_collector(sp, fp);
         }
-        int block_size = (asize+GVMT_ALLOCATOR_BLOCK_SIZE-1) & 
-                         (~(GVMT_ALLOCATOR_PAGE_SIZE-1));
-        char* mem_block = get_block(sp, fp, block_size);
-        gvmt_gc_free_pointer = (GVMT_StackItem*)mem_block;
-        gvmt_gc_limit_pointer = (GVMT_StackItem*)(mem_block + block_size);
+        get_chunk(sp, fp, asize);
         return bump_pointer_alloc(asize);
     }
     
     template<class Allocator> inline char* get_block_synchronised() {
         char *result;
-        if (gvmt_gc_waiting)
+        if (mutator::gc_requested())
             return NULL;
         pthread_mutex_lock(&lock);
         result = Allocator::get_block();
@@ -88,6 +140,34 @@ namespace allocator {
     
 };
 
+namespace handshake {
+    
+    struct Entry;
+    
+    /** Handshakes posted to this thread, not yet run */
+    extern GVMT_THREAD_LOCAL Entry* volatile queue;
+    
+    void run(void);
+    
+    void kick(void);
+    
+    /** Run any handshakes posted to this thread */
+    inline void poll(void) {
+        if (queue)
+            run();
+    }
+    
+};
+
+namespace roots {
+    
+    /** Move finalizables registered, and weak references written, since the
+     * last collection to GC::finalizables and GC::young_weak_references.
+     * The world must be stopped. */
+    void flush(void);
+    
+};
+
 namespace finalizer {
     void init(void);
 };
@@ -30,6 +30,12 @@
 
 #define BITS_PER_WORD (sizeof(void*)*8)
 
+/* Maximum nesting of child-first copying in Memory::hierarchical_copy.
+ * Zero restores plain mark-stack (LIFO) copy order. */
+#ifndef GVMT_HIERARCHICAL_COPY_DEPTH
+#define GVMT_HIERARCHICAL_COPY_DEPTH 8
+#endif
+
 inline static bool crosses_power_of_2(char* ptr, size_t size, intptr_t power2) {
     size_t space = power2 - (((intptr_t)ptr) & (power2-1));
     return space < size;  
@@ -163,6 +169,8 @@ public:
     
     void clear_modified_map();
     
+    void zero();
+    
 #ifdef NDEBUG    
     inline void verify() {}
 #else
@@ -684,6 +692,7 @@ namespace GC {
     extern std::vector<Block*> mark_stack_blocks;
     extern Address* mark_stack_pointer;
     extern Block* mark_stack_reserve;
+    extern int copy_depth;
     
     inline void push_mark_stack(Address addr) {
 #ifndef NDEBUG
@@ -765,15 +774,8 @@ public:
         assert(!Block::containing(from)->is_pinned());
         assert(Block::containing(from)->is_valid());
         assert(Block::containing(to)->is_valid());
-        Address to_ptr, from_ptr, end;
-        to_ptr = to;
-        from_ptr = from;
-        end = to.plus_bytes(size);
-        do {
-            to_ptr.write_word(from_ptr.read_word());
-            to_ptr = to_ptr.next_word();
-            from_ptr = from_ptr.next_word();
-        } while (to_ptr < end);
+        assert(size > 0);
+        gc::copy_object(from, to, size);
     }
     
     template <class Policy> static inline GVMT_Object copy(Address a) {
@@ -789,6 +791,30 @@ public:
         return result.as_object();
     }
     
+    /** As copy(), but scans the copy immediately, so that its children are 
+     * copied directly after it (depth first), rather than in mark-stack order. 
+     * This keeps parents and children in the same lines. 
+     * Nesting is bounded by GVMT_HIERARCHICAL_COPY_DEPTH; beyond that, 
+     * or for objects larger than a line, falls back to the mark stack. */
+    template <class Collection> static inline GVMT_Object hierarchical_copy(Address a) {
+        if (forwarded(a)) {
+            return forwarding_address(a);
+        }
+        size_t size = align(gvmt_user_length(a.as_object()));
+        Address result = Collection::policy::allocate(size);
+        move(a, result, size);
+        set_forwarding_address(a, result);
+        Zone::mark(result);
+        if (GC::copy_depth < GVMT_HIERARCHICAL_COPY_DEPTH && size <= Line::size) {
+            ++GC::copy_depth;
+            Address end = gc::scan_object<Collection>(result);
+            Collection::scanned(result, end);
+            --GC::copy_depth;
+        } else {
+            GC::push_mark_stack(result);
+        }
+        return result.as_object();
+    }
     
 };
 
@@ -15,6 +15,8 @@ extern "C" {
 #endif 
 
 extern int gvmt_abort_on_unexpected_parameter_usage;
+/** If non-zero, threads scan their own stacks for roots before parking for GC */
+extern int gvmt_gc_stack_self_scan;
 extern int gvmt_warn_on_unexpected_parameter_usage;
 extern double gvmt_heap_residency;
 
@@ -27,6 +29,8 @@ extern int gvmt_major_collections;
 extern int64_t gvmt_minor_collection_time;
 extern int64_t gvmt_major_collection_time;
 extern int64_t gvmt_total_collection_time;
+/** Time spent bringing threads to a safe point before collecting */
+extern int64_t gvmt_safepoint_time;
 extern int64_t gvmt_total_compilation_time;
 extern int64_t gvmt_total_optimisation_time;
 extern int64_t gvmt_total_codegen_time;
@@ -45,6 +49,11 @@ typedef union gvmt_reference_types *GVMT_Object;
 
 typedef struct gsc_stream* GSC_Stream;
 
+/** See gvmt_open_handle_scope() in native.h */
+typedef struct gvmt_handle_scope {
+    void* top;
+} GVMT_HandleScope;
+
 extern uintptr_t GVMT_MAX_OBJECT_NAME_LENGTH;
 
 extern uintptr_t GVMT_MAX_SHAPE_SIZE;
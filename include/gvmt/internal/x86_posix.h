@@ -40,5 +40,57 @@ __attribute__((unused)) static uint32_t gvmt_bswap(uint32_t val)
 
 #define _gvmt_fetch_4(x) gvmt_bswap(*((uint32_t*)x))
 
+/** Time stamp counter, for gvmtas -Q 2 */
+__attribute__((unused)) static inline uint64_t gvmt_cycle_count(void)
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/** Polling safe point: a single load from the polling page.
+ * The collector read-protects the page to stop threads; the SIGSEGV handler
+ * diverts the faulting thread to a trampoline, which finds the GVMT stack 
+ * and frame pointers in %eax and %edx. */
+#define GVMT_GC_POLL(sp, fp) \
+__asm__ __volatile__("testl %%eax, (%2)" : : "a"(sp), "d"(fp), \
+                     "r"(gvmt_gc_poll_page) : "memory")
+
+/** On return from the signal handler, calls target, which returns to 
+ * the faulting load. */
+#define GVMT_GC_POLL_DIVERT(uc, target) do { \
+    greg_t* gregs = ((ucontext_t*)(uc))->uc_mcontext.gregs; \
+    gregs[REG_ESP] -= sizeof(greg_t); \
+    *(greg_t*)gregs[REG_ESP] = gregs[REG_EIP]; \
+    gregs[REG_EIP] = (greg_t)(target); \
+} while (0)
+
+/** Defines name, the target of GVMT_GC_POLL_DIVERT. It saves the flags, 
+ * registers and FPU state, calls the cdecl function wait(sp, fp) on a
+ * 16 byte aligned stack, then restores them and returns. */
+#define GVMT_GC_POLL_TRAMPOLINE(name, wait) \
+__asm__(".text\n" \
+        ".align 16\n" \
+        ".globl " #name "\n" \
+        ".hidden " #name "\n" \
+        #name ":\n" \
+        "    pushfl\n" \
+        "    pushal\n" \
+        "    movl %esp, %ebx\n" \
+        "    subl $512, %esp\n" \
+        "    andl $-16, %esp\n" \
+        "    fxsave (%esp)\n" \
+        "    subl $16, %esp\n" \
+        "    movl %eax, (%esp)\n" \
+        "    movl %edx, 4(%esp)\n" \
+        "    call " #wait "\n" \
+        "    addl $16, %esp\n" \
+        "    fxrstor (%esp)\n" \
+        "    movl %ebx, %esp\n" \
+        "    popal\n" \
+        "    popfl\n" \
+        "    ret\n")
+#define GVMT_HAVE_POLLING_PAGE 1
+
 #endif // GVMT_X86_POSIX_H
 
@@ -29,6 +29,14 @@ struct gvmt_registers {
 #define _gvmt_fetch_4(x) \
     ((x[0] << 24) | (x[1] << 16) | (x[2] << 8) | x[3])
 
+#include <intrin.h>
+#define gvmt_cycle_count() ((uint64_t)__rdtsc())
+
+// No polling page on this platform; fall back to testing the flag.
+#define GVMT_GC_POLL(sp, fp) \
+    if (gvmt_gc_waiting) gvmt_gc_safe_point(sp, fp)
+#define GVMT_HAVE_POLLING_PAGE 0
+
 
 
 
@@ -31,6 +31,56 @@ void gvmt_set_tracing(int s);
 /** Returns the (thread-local) tracing state. */
 int gvmt_get_tracing(void);
 
+typedef void (*gvmt_handshake_func)(int32_t thread_id, void* arg);
+
+/** Runs func(thread_id, arg) for the GVMT thread thread_id at its next 
+ * safe point, without stopping other threads. Returns when done.
+ * Must be called from native code. */
+void gvmt_handshake(int32_t thread_id, gvmt_handshake_func func, void* arg);
+
+/** As gvmt_handshake(), for every GVMT thread other than the caller. */
+void gvmt_handshake_all(gvmt_handshake_func func, void* arg);
+
+/** Handle scopes.
+ * A handle is a root slot that lives until the innermost open scope is
+ * closed. Creating one costs a couple of stores, with no locking.
+ * Scopes must be closed in the reverse order to which they were opened,
+ * and all scopes opened in a native call must be closed before it returns.
+ * For use from native code, in GVMT threads only. */
+void gvmt_open_handle_scope(GVMT_HandleScope* scope);
+
+/** Returns a new handle, in the innermost open scope, initialised to obj */
+GVMT_Object* gvmt_new_handle(GVMT_Object obj);
+
+/** Frees all handles created since scope was opened */
+void gvmt_close_handle_scope(GVMT_HandleScope* scope);
+
+/** Allocation statistics of a GVMT thread */
+typedef struct gvmt_allocation_stats {
+    int32_t thread_id;
+    /** Size of the thread-local chunks the thread is currently given */
+    int32_t chunk_size;
+    /** Bytes and number of chunks taken since the thread started */
+    uint64_t bytes;
+    uint64_t chunks;
+    /** Rate between the last two collections, in bytes per second */
+    uint64_t rate;
+} GVMT_AllocationStats;
+
+/** Copies the statistics of up to max threads into stats.
+ * Returns the number of GVMT threads. 
+ * Only the multi-threaded allocators keep these statistics. */
+int gvmt_allocation_stats(GVMT_AllocationStats* stats, int max);
+
+/** Writes the opcode profile of interpreters built with gvmtas -Q,
+ * summed over all threads, to filename. If filename is NULL, writes to
+ * $GVMT_OPCODE_PROFILE, or gvmt.opcodes. This is done at exit anyway. */
+void gvmt_write_opcode_profile(const char* filename);
+
+/** Writes the opcode profile, as above, whenever signal sig is received.
+ * The profile is written by a helper thread, not in the signal handler. */
+void gvmt_opcode_profile_on_signal(int sig);
+
 /** Allows exceptions to be raised from native code*/
 void gvmt_raise_native(void* ex);
 void gvmt_transfer_native(void* ex);
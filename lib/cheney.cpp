@@ -47,21 +47,8 @@ namespace cheney {
      * Both from and to are real (untagged) addresses.
      * Returns the size of the object just moved */
     inline size_t move(GVMT_Object from, Address to) {
-        int shape_buffer[16];
-        int* shape = gvmt_user_shape((GVMT_Object)from, shape_buffer);
-        int len =  0;
-        Address real_from = Address(from);
-        while (*shape) {
-            if (*shape < 0)
-                len -= *shape++;
-            else 
-                len += *shape++;
-        }
-        size_t size = len * sizeof(void*);
-        // Copy object
-        
-        memcpy (reinterpret_cast<void*>(to.bits()), 
-                reinterpret_cast<void*>(real_from.bits()), size);
+        size_t size = align(gvmt_user_length(from));
+        gc::copy_object(Address(from), to, size);
         return size;
     }
     
@@ -138,24 +125,27 @@ namespace cheney {
             scan = it.end_address();
         } 
         // Now have to scan finalizers:
-        int n = GC::finalizables.size();
-        for(int i = 0; i < n; i++) {
-            GVMT_Object obj = GC::finalizables.back();
-            GC::finalizables.pop_back();
+        std::vector<GVMT_Object>& finalizables = GC::old_finalizables;
+        finalizables.insert(finalizables.end(), GC::finalizables.begin(), 
+                            GC::finalizables.end());
+        GC::finalizables.clear();
+        size_t kept = 0;
+        for (size_t i = 0; i < finalizables.size(); i++) {
+            GVMT_Object obj = finalizables[i];
             if (to_be_copied(obj)) {
                 if (forwarded(obj)) {
                     obj = forwarding_address(obj);
-                    GC::finalizables.push_front(obj);
                 } else {
                     // obj is in old_space, so it needs to be finalized
                     // Copy, add to finalization Q, then remove from finalizers.
                     obj = copy(obj);
                     GC::finalization_queue.push_front(obj);
+                    continue;
                 }
-            } else {
-                GC::finalizables.push_front(obj);  
             }
+            finalizables[kept++] = obj;
         }
+        finalizables.resize(kept);
         // And scan any newly moved objects.
         while (scan < Address(free)) {
             int shape_buffer[GVMT_MAX_SHAPE_SIZE];
@@ -178,6 +168,7 @@ namespace cheney {
                 }
             }
         }
+        GC::young_weak_references.clear();
         // Zero out remaining free memory
         memset(free, 0, top_of_space-free);
 //        fprintf(stderr, "GC completed\n");
@@ -234,6 +234,14 @@ void CompilerStack::flush(BasicBlock* bb) {
 //    stack_pointer = 0;
 }
 
+Value* CompilerStack::snapshot(unsigned count, std::vector<Value*>& items, BasicBlock* bb) {
+    unsigned n = stack.size() > count ? stack.size() : count;
+    items.clear();
+    for (unsigned i = 0; i < n; i++)
+        items.push_back(pick(BaseCompiler::TYPE_X, bb, i));
+    return top(bb);
+}
+
 void CompilerStack::max_join_depth(unsigned max, BasicBlock* bb) {
     Constant* one = ConstantInt::get(APInt(32, 1, true));
     while(max > join_cache.size()) {
@@ -445,6 +453,8 @@ BaseCompiler::BaseCompiler() {
     GC_MALLOC_FAST_FUNC->setCallingConv(CallingConv::X86_FastCall);
     execution_engine = 0;
     ref_temps_base = 0;
+    deopt_interpreter = 0;
+    deopt_ip = 0;
 }
 
 Value* BaseCompiler::ref_temp(int index, BasicBlock* bb) {
@@ -464,6 +474,10 @@ void BaseCompiler::initialiseFrame(Value* caller_frame, int locals,
     Value* count_offset = ConstantInt::get(APInt(32, offsetof(struct gvmt_frame, count)));
     Value* frame_count = new BitCastInst(GetElementPtrInst::Create(frame, count_offset, "x", bb), POINTER_TYPE_I4, "frame_count", bb);
     store(ConstantInt::get(APInt(32, count)), frame_count, bb);
+    // Compiled code has no frame write barrier.
+    Value* scanned_offset = ConstantInt::get(APInt(32, offsetof(struct gvmt_frame, scanned)));
+    Value* frame_scanned = new BitCastInst(GetElementPtrInst::Create(frame, scanned_offset, "x", bb), POINTER_TYPE_I4, "frame_scanned", bb);
+    store(ConstantInt::get(APInt(32, GVMT_FRAME_ALWAYS_SCAN)), frame_scanned, bb);
     FRAME = frame;
     for (int i = 0; i < locals; i++) {
         store(ConstantPointerNull::get(TYPE_R), ref_temp(i, bb), bb);
@@ -473,6 +487,22 @@ void BaseCompiler::initialiseFrame(Value* caller_frame, int locals,
 //    CallInst::Create(CHECK_FRAME, &params[0], &params[2], "", bb);
 }
 
+Value* BaseCompiler::osr_frame(void) {
+    Value* interpreter_frame = stack->pop(TYPE_P, current_block);
+    stack->flush(current_block);
+    return interpreter_frame;
+}
+
+void BaseCompiler::osr_local(Value* interpreter_frame, unsigned int offset, 
+                             Value* laddr, const Type* type) {
+    const Type* ptr_type = PointerType::get(type, 0);
+    Value* from = GetElementPtrInst::Create(interpreter_frame, 
+                        ConstantInt::get(APInt(32, offset)), "x", current_block);
+    from = new BitCastInst(from, ptr_type, "x", current_block);
+    Value* to = new BitCastInst(laddr, ptr_type, "x", current_block);
+    store(new LoadInst(from, "local", current_block), to, current_block);
+}
+
 extern "C" {
     void  gvmt_print_int(int x) {  
         fprintf(stderr, "%d\n", x);
@@ -669,6 +699,137 @@ Value* BaseCompiler::cast_to_R(Value* from, BasicBlock* bb) {
     return cast_to_P(from, bb);
 }
 
+InlineCache::InlineCache(uint8_t* ip, Value* key, int offset) :
+    key(key), offset(offset) {
+    count = gvmt_inline_cache_read(ip, offset, keys, targets);
+}
+
+static Constant* constant_pointer(void* ptr, const Type* type) {
+    Constant* address = ConstantInt::get(APInt(sizeof(void*)*8, (intptr_t)ptr));
+    return ConstantExpr::getIntToPtr(address, type);
+}
+
+Value* BaseCompiler::cached_target(InlineCache& cache, BasicBlock* bb) {
+    Value* offset = ConstantInt::get(APInt(32, cache.offset));
+    Value* gep = GetElementPtrInst::Create(cache.key, offset, "x", bb);
+    return new LoadInst(new BitCastInst(gep, POINTER_TYPE_P, "x", bb), "target", bb);
+}
+
+/* Calls target in bb, in native mode if native */
+static CallInst* call_target(Value* target, unsigned cc, Value** args, 
+                             Value** args_end, bool native, BasicBlock* bb) {
+    Value* no_args[] = { 0 };
+    if (native)
+        CallInst::Create(Architecture::ENTER_NATIVE, &no_args[0], &no_args[0], "", bb);
+    CallInst* call = CallInst::Create(target, args, args_end, "", bb);
+    call->setCallingConv(cc);
+    if (native)
+        CallInst::Create(Architecture::EXIT_NATIVE, &no_args[0], &no_args[0], "", bb);
+    return call;
+}
+
+Value* BaseCompiler::cached_call(InlineCache& cache, const PointerType* func_type,
+                                 unsigned cc, Value** args, Value** args_end,
+                                 bool native) {
+    const Type* result_type = cast<FunctionType>(func_type->getElementType())->getReturnType();
+    BasicBlock* join = 0;
+    PHINode* result = 0;
+    CallInst* call = 0;
+    // Only speculate on keys the interpreter has seen if it can take over.
+    bool speculate = cache.count > 0 && deopt_ip == IP;
+    if (cache.count > 0) {
+        join = makeBB("cached_call");
+        if (result_type != TYPE_V)
+            result = PHINode::Create(result_type, "", join);
+    }
+    for (int i = 0; i < cache.count; i++) {
+        BasicBlock* hit = makeBB("cache_hit");
+        BasicBlock* miss = makeBB("cache_miss");
+        Value* key = constant_pointer(cache.keys[i], TYPE_P);
+        Value* test = new ICmpInst(ICmpInst::ICMP_EQ, cache.key, key, "", current_block);
+        BranchInst::Create(hit, miss, test, current_block);
+        Value* target = constant_pointer(cache.targets[i], func_type);
+        call = call_target(target, cc, args, args_end, native, hit);
+        if (result)
+            result->addIncoming(call, hit);
+        BranchInst::Create(join, hit);
+        current_block = miss;
+    }
+    if (speculate) {
+        deoptimise(current_block);
+        current_block = join;
+        if (result)
+            return result;
+        return call;
+    }
+    // Unseen key, or no keys recorded: call the target loaded from the key.
+    Value* target = new BitCastInst(cached_target(cache, current_block), 
+                                    func_type, "", current_block);
+    call = call_target(target, cc, args, args_end, native, current_block);
+    if (join == 0)
+        return call;
+    if (result)
+        result->addIncoming(call, current_block);
+    BranchInst::Create(join, current_block);
+    current_block = join;
+    if (result)
+        return result;
+    return call;
+}
+
+Value* BaseCompiler::feedback(Value* value) {
+    uintptr_t seen;
+    if (deopt_ip != IP)
+        return value;
+    if (gvmt_feedback_read(ip_start, IP, &seen) != GVMT_FEEDBACK_MONOMORPHIC)
+        return value;
+    Constant* expected = ConstantInt::get(value->getType(), seen);
+    BasicBlock* hit = makeBB("feedback");
+    BasicBlock* miss = makeBB("feedback_miss");
+    Value* test = new ICmpInst(ICmpInst::ICMP_EQ, value, expected, "", current_block);
+    BranchInst::Create(hit, miss, test, current_block);
+    deoptimise(miss);
+    current_block = hit;
+    return expected;
+}
+
+void BaseCompiler::deopt_point(int inputs) {
+    if (!jitting || deopt_interpreter == 0)
+        return;
+    // Stop speculating on bytecodes that keep deoptimising.
+    struct gvmt_tier* tier = gvmt_tier_lookup(ip_start);
+    if (tier && tier->deopts >= GVMT_TIER_MAX_DEOPTS)
+        return;
+    deopt_ip = IP;
+    deopt_sp = stack->snapshot(inputs, deopt_items, current_block);
+}
+
+void BaseCompiler::deoptimise(BasicBlock* bb) {
+    assert(deopt_ip == IP);
+    for (unsigned i = 0; i < deopt_items.size(); i++) {
+        Value* item = deopt_items[i];
+        Value* slot = GetElementPtrInst::Create(deopt_sp, ConstantInt::get(APInt(32, i)), "x", bb);
+        slot = new BitCastInst(slot, PointerType::get(item->getType(), 0), "x", bb);
+        store(item, slot, bb);
+    }
+    // The interpreter expects NULL, ip_end, ip, the frame and ip_start, 
+    // see gvmtas.
+    Value* record[] = { ConstantPointerNull::get(TYPE_P), 
+                        constant_pointer(ip_end, TYPE_P),
+                        constant_pointer(deopt_ip, TYPE_P), FRAME,
+                        constant_pointer(ip_start, TYPE_P) };
+    Value* sp = GetElementPtrInst::Create(deopt_sp, ConstantInt::get(APInt(32, -5, true)), "x", bb);
+    for (int i = 0; i < 5; i++) {
+        Value* slot = GetElementPtrInst::Create(sp, ConstantInt::get(APInt(32, i)), "x", bb);
+        store(record[i], new BitCastInst(slot, POINTER_TYPE_P, "x", bb), bb);
+    }
+    Value* interpreter = constant_pointer((void*)deopt_interpreter, Architecture::POINTER_FUNCTION_TYPE);
+    Value* args[] = { sp, FRAME };
+    CallInst* call = CallInst::Create(interpreter, &args[0], &args[2], "", bb);
+    call->setCallingConv(current_function->getCallingConv());
+    ReturnInst::Create(call, bb);
+}
+
 BasicBlock* BaseCompiler::makeBB(std::string name, int index) {
     char buf[12];
     if (index)
@@ -109,6 +109,12 @@ extern "C" {
         GVMT_RETURN_V;
     }
     
+    GVMT_LINKAGE_2(gvmt_gc_write_weak_reference, void* ref, void* obj)
+        *((GVMT_Object*)ref) = (GVMT_Object)obj;
+        GC::young_weak_references.push_back((GVMT_Object*)ref);
+        GVMT_RETURN_V;
+    }
+    
     void inform_gc_new_stack(void) {
         GC::stacks.push_back(Stack(gvmt_stack_base, &gvmt_stack_pointer));
         GC::frames.push_back(FrameStack(&gvmt_frame_pointer));
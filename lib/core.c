@@ -29,15 +29,20 @@ GVMT_THREAD_LOCAL GVMT_StackItem* gvmt_stack_pointer;
 GVMT_THREAD_LOCAL int gvmt_thread_non_native;
 
 int8_t gvmt_gc_waiting = 0;
+/* Always readable unless the collector installs a real polling page. */
+static int32_t gvmt_gc_poll_word;
+char* gvmt_gc_poll_page = (char*)&gvmt_gc_poll_word;
 intptr_t gvmt_uninitialised_field = 4;
 
 int gvmt_abort_on_unexpected_parameter_usage = 0;
+int gvmt_gc_stack_self_scan = 1;
 int gvmt_warn_on_unexpected_parameter_usage = 1;                      
 int gvmt_minor_collections = 0;
 int gvmt_major_collections = 0;
 int64_t gvmt_minor_collection_time = 0;
 int64_t gvmt_major_collection_time = 0;
 int64_t gvmt_total_collection_time = 0;
+int64_t gvmt_safepoint_time = 0;
 int64_t gvmt_total_compilation_time = 0;
 int64_t gvmt_total_optimisation_time = 0;
 int64_t gvmt_total_codegen_time = 0;
@@ -94,6 +99,30 @@ uintptr_t gvmt_stack_depth(void) {
     return gvmt_stack_base-gvmt_stack_pointer;
 }
 
+/* Handles are pushed on the GVMT stack, below the stack pointer saved on 
+ * entering native code, so the GC finds them as it does any other stack 
+ * slot. gvmt_call() pushes above them, so they survive calls back into 
+ * GVMT code. The slot is written before the stack pointer is moved, so a
+ * collector never scans an uninitialised handle. */
+void gvmt_open_handle_scope(GVMT_HandleScope* scope) {
+    scope->top = gvmt_stack_pointer;
+}
+
+GVMT_Object* gvmt_new_handle(GVMT_Object obj) {
+    GVMT_StackItem* sp = gvmt_stack_pointer - 1;
+    if (sp < gvmt_stack_limit)
+        __gvmt_fatal("GVMT stack overflow creating handle\n");
+    sp->o = obj;
+    __asm__ __volatile__ ("" : : : "memory");
+    gvmt_stack_pointer = sp;
+    return &sp->o;
+}
+
+void gvmt_close_handle_scope(GVMT_HandleScope* scope) {
+    assert((GVMT_StackItem*)scope->top >= gvmt_stack_pointer);
+    gvmt_stack_pointer = (GVMT_StackItem*)scope->top;
+}
+
 #define WORD_SIZE sizeof(void*)
 #define DOUBLE_WORD_SIZE  (2 * WORD_SIZE) 
 
@@ -4,6 +4,7 @@
 Root::Block Root::GC_ROOTS_BLOCK = {
     &gvmt_start_roots,
     &gvmt_end_roots,
+    0,
     0
 };
 
@@ -15,9 +16,10 @@ Root::List Root::GC_ROOTS = {
 
 Root::Block* Root::allocateBlock() {
     Root::Block* b = new Root::Block();
-    b->start = new GVMT_Object[ROOT_LIST_BLOCK_SIZE];
+    b->start = new GVMT_Object[ROOT_LIST_BLOCK_SIZE]();
     b->end = b->start + ROOT_LIST_BLOCK_SIZE;
     b->next = 0;
+    b->previous = 0;
     return b;
 }
 
@@ -26,8 +28,11 @@ namespace GC {
     std::deque<GVMT_Object> finalization_queue;
     std::vector<Stack> stacks;
     std::vector<FrameStack> frames;
-    std::deque<GVMT_Object> finalizables;
+    std::vector<ScannedRoots*> scanned_roots;
+    std::vector<GVMT_Object> finalizables;
+    std::vector<GVMT_Object> old_finalizables;
     Root::List weak_references;
+    std::vector<GVMT_Object*> young_weak_references;
        
 }
 
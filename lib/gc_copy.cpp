@@ -9,6 +9,9 @@ char copy_non_gen_name[] = "copy";
 class Copy {  // Collection
 public:
     
+    static const bool skip_clean_frames = false;
+    static const bool young_only = false;
+    
     static inline bool wants(GVMT_Object p) {
         return gc::is_address(p);
     }
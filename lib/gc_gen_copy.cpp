@@ -14,6 +14,9 @@ namespace gen_copy {
 class CopyBase {
   public: 
     
+    static const bool skip_clean_frames = false;
+    static const bool young_only = false;
+    
     static inline GVMT_Object apply(GVMT_Object p) {
         assert(gc::is_address(p));
         if (semispace::forwarded(p)) {
@@ -38,6 +41,9 @@ class CopyBase {
 class CopyMinor: public CopyBase { 
 public:
     
+    /** All nursery survivors are promoted */
+    static const bool young_only = true;
+    
     static inline bool wants(GVMT_Object p) {
         return gc::is_address(p) && generational::in_nursery(p);
     }
@@ -132,6 +138,13 @@ extern "C" {
         return static_cast<void*>(obj);
     }
     
+    GVMT_LINKAGE_1 (gvmt_malloc_pinned, void* size)
+        (void)size;
+        fprintf(stderr, "Pinning not supported\n");
+        abort();
+        GVMT_RETURN_R(0);
+    }
+    
     GVMT_LINKAGE_1 (gvmt_gc_unpin, void* obj)
         (void)obj; // Use obj to keep compiler quiet
         fprintf(stderr, "Pinning not supported\n");
@@ -20,6 +20,14 @@
  * must be obtained before mutator::threads can be altered to or from 0.
  * Additionally in order to halt threads reentering GVMT code from native,
  * the collector locks collector::lock while it is collecting.
+ *
+ * On Linux (GVMT_FUTEX_HANDSHAKE) the above is replaced:
+ * Each thread has its own state word, RUNNING, PARKED or NATIVE, which only 
+ * it writes, other than a handshake requester holding it HANDSHAKING. 
+ * There is no collector thread; the first thread to park while 
+ * gvmt_gc_waiting is set takes collector::owner, futex-waits on the state 
+ * word of each RUNNING thread, collects, then bumps collector::epoch and 
+ * wakes the parked threads waiting on it.
  */
 
 // READ THIS
@@ -37,10 +45,125 @@
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#if HAVE_COMPARE_AND_SWAP && defined(__linux__)
+#  define GVMT_FUTEX_HANDSHAKE 1
+#  define GVMT_PER_CPU_CACHES 1
+#else
+#  define GVMT_FUTEX_HANDSHAKE 0
+#  define GVMT_PER_CPU_CACHES 0
+#endif
 
 // Prototype for compare and swap
 //extern bool COMPARE_AND_SWAP(int* addr, int old_val, int new_val);
 
+/** Polling-page safe points (gvmtas -P).
+ * Code compiled with -P reads gvmt_gc_poll_page at each safe point rather
+ * than testing gvmt_gc_waiting. To stop the world the page is read-protected,
+ * so each running thread faults at its next safe point. Waiting for the 
+ * collector is not async-signal-safe, so the fault handler only diverts the
+ * thread to a trampoline, which waits once the handler has returned and then
+ * retries the load. Code compiled without -P is unaffected; gvmt_gc_waiting 
+ * is still set. */
+namespace safepoint {
+
+    struct sigaction previous;
+    size_t page_size;
+
+    inline void arm(void) {
+#if GVMT_HAVE_POLLING_PAGE
+        mprotect(gvmt_gc_poll_page, page_size, PROT_NONE);
+#endif
+    }
+    
+    inline void disarm(void) {
+#if GVMT_HAVE_POLLING_PAGE
+        mprotect(gvmt_gc_poll_page, page_size, PROT_READ);
+#endif
+    }
+    
+#if GVMT_HAVE_POLLING_PAGE
+
+    extern "C" __attribute__((visibility("hidden")))
+    void gvmt_gc_poll_trampoline(void);
+    
+    void handler(int sig, siginfo_t* info, void* context) {
+        char* addr = (char*)info->si_addr;
+        if (addr >= gvmt_gc_poll_page && addr < gvmt_gc_poll_page + page_size) {
+            GVMT_GC_POLL_DIVERT(context, gvmt_gc_poll_trampoline);
+            return;
+        }
+        // Not a safe point, pass on to whoever was there before.
+        if (previous.sa_flags & SA_SIGINFO) {
+            previous.sa_sigaction(sig, info, context);
+        } else if (previous.sa_handler == SIG_DFL || 
+                   previous.sa_handler == SIG_IGN) {
+            // Restore default action; faulting instruction will be re-executed.
+            sigaction(sig, &previous, NULL);
+        } else {
+            previous.sa_handler(sig);
+        }
+    }
+    
+    /** Called by the trampoline, after the handler has returned. */
+    extern "C" __attribute__((visibility("hidden")))
+    void gvmt_gc_poll_wait(GVMT_StackItem* sp, GVMT_Frame fp) {
+        mutator::wait_for_collector(sp, fp);
+    }
+    
+    GVMT_GC_POLL_TRAMPOLINE(gvmt_gc_poll_trampoline, gvmt_gc_poll_wait);
+    
+    void init(void) {
+        page_size = getpagesize();
+        void* page = mmap(NULL, page_size, PROT_READ, 
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED) {
+            fprintf(stderr, "Cannot allocate polling page\n");
+            abort();
+        }
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = handler;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previous);
+        gvmt_gc_poll_page = (char*)page;
+    }
+    
+#else
+
+    void init(void) {
+    }
+    
+#endif
+
+}
+
+namespace mutator {
+    
+    GVMT_THREAD_LOCAL ScannedRoots* scanned_roots;
+    
+    /** Walk our own stack before parking, so the collector doesn't have to. 
+     * The stack cannot change until we resume. */
+    inline void scan_own_stack(void) {
+        if (gvmt_gc_stack_self_scan && gc_requested())
+            scanned_roots->scan(Stack(gvmt_stack_base, &gvmt_stack_pointer), 
+                                FrameStack(&gvmt_frame_pointer));
+    }
+    
+}
+
+#if !GVMT_FUTEX_HANDSHAKE
+
 namespace mutator {
     
     pthread_cond_t all_stopped;
@@ -53,8 +176,17 @@ namespace mutator {
     
     inline void decrement_rt_count(void);
     
+    inline void exit_native(void) {
+        increment_rt_count();
+    }
+    
+    inline void enter_native(void) {
+        decrement_rt_count();
+    }
+    
     void init() {
         pthread_cond_init(&all_stopped, NULL);
+        safepoint::init();
     }
 }
 
@@ -101,7 +233,8 @@ namespace dummy_thread {
 namespace mutator {   
 
     void request_gc() {
-        gvmt_gc_waiting = true;
+        __sync_fetch_and_or(&gvmt_gc_waiting, GVMT_WAITING_GC);
+        safepoint::arm();
         dummy_thread::stop();
     }
     
@@ -126,12 +259,15 @@ namespace collector {
         do {
             // Just wait for all-stopped, do collection & repeat
             pthread_cond_wait(&mutator::all_stopped, &lock);
-            if (gvmt_gc_waiting && mutator::threads == 0) {
+            if (mutator::gc_requested() && mutator::threads == 0) {
                 // Decrement threads, so debugging can see collection is occuring
                 mutator::threads--;
+                roots::flush();
                 gvmt_do_collection();
                 allocator::zero_limit_pointers();
-                gvmt_gc_waiting = false;
+                allocator::end_interval();
+                safepoint::disarm();
+                __sync_fetch_and_and(&gvmt_gc_waiting, ~GVMT_WAITING_GC);
                 // "Restart" dummy thread
                 dummy_thread::running = 1;
                 mutator::threads = 1;
@@ -151,6 +287,8 @@ namespace collector {
 
 }
 
+#endif
+
 namespace finalizer {
     
     pthread_t thread;
@@ -169,7 +307,7 @@ namespace finalizer {
         gvmt_setjump(&handler->registers, sp);
         // Don't care if exeception was raised or not, just carry on
         do {   
-            while (GC::finalization_queue.empty() || gvmt_gc_waiting) {
+            while (GC::finalization_queue.empty() || mutator::gc_requested()) {
                 mutator::wait_for_collector(sp, fp);
             }
             assert(!GC::finalization_queue.empty());
@@ -193,7 +331,154 @@ namespace finalizer {
      
 }
 
-#if HAVE_COMPARE_AND_SWAP
+#if GVMT_FUTEX_HANDSHAKE
+
+namespace futex {
+
+    inline void wait(volatile int32_t* addr, int32_t val) {
+        syscall(SYS_futex, (int32_t*)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+    }
+
+    inline void wake(volatile int32_t* addr, int32_t count) {
+        syscall(SYS_futex, (int32_t*)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+    }
+
+}
+
+namespace mutator {
+
+    enum { RUNNING, PARKED, NATIVE, HANDSHAKING };
+
+    /** Safepoint state word of this thread. Only the owning thread writes it,
+     * except that a handshake requester may take it from NATIVE or PARKED
+     * to HANDSHAKING and back. A collecting thread reads it via mutator::states 
+     * and futex-waits on it while it is RUNNING or HANDSHAKING. 
+     * Threads start NATIVE. */
+    GVMT_THREAD_LOCAL volatile int32_t state = NATIVE;
+    std::vector<volatile int32_t*> states;
+
+    void init() {
+        safepoint::init();
+    }
+
+    /** Store then fence, so that either this thread sees a GC request,
+     * or the collector sees the new state. */
+    inline void set_state(int32_t s) {
+        state = s;
+        __sync_synchronize();
+        if (s != RUNNING && gc_requested())
+            futex::wake(&state, 1);
+    }
+
+    void request_gc() {
+        __sync_fetch_and_or(&gvmt_gc_waiting, GVMT_WAITING_GC);
+        safepoint::arm();
+    }
+
+}
+
+namespace collector {
+
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    /** Non-zero while a mutator is collecting */
+    volatile int32_t owner = 0;
+    /** Incremented at the end of every collection. Parked threads wait on it. */
+    volatile int32_t epoch = 0;
+
+    /** Stop the world and collect, on the calling thread.
+     * Caller must have won collector::owner and be PARKED. */
+    void collect(void) {
+        int64_t t0 = high_res_time();
+        volatile int32_t* running;
+        int32_t s;
+        std::vector<volatile int32_t*>::iterator it;
+        // Don't hold the lock while waiting, a running thread may need it
+        // to get to its next safe point.
+        do {
+            running = NULL;
+            pthread_mutex_lock(&lock);
+            for (it = mutator::states.begin(); it != mutator::states.end(); it++) {
+                s = **it;
+                if (s == mutator::RUNNING || s == mutator::HANDSHAKING) {
+                    running = *it;
+                    break;
+                }
+            }
+            if (running == NULL)
+                break;
+            pthread_mutex_unlock(&lock);
+            futex::wait(running, s);
+        } while (true);
+        gvmt_safepoint_time += high_res_time() - t0;
+        roots::flush();
+        gvmt_do_collection();
+        allocator::zero_limit_pointers();
+        allocator::end_interval();
+        safepoint::disarm();
+        __sync_fetch_and_and(&gvmt_gc_waiting, ~GVMT_WAITING_GC);
+        owner = 0;
+        __sync_fetch_and_add(&epoch, 1);
+        futex::wake(&epoch, INT_MAX);
+        pthread_mutex_unlock(&lock);
+    }
+
+    void init(void) {
+    }
+
+}
+
+namespace mutator {
+
+    /** Park until epoch has moved on from e, collecting if no-one else is.
+     * Returns with this thread RUNNING and no collection pending. */
+    void block(int32_t e) {
+        do {
+            set_state(PARKED);
+            // Requester may have missed us, see handshake::request.
+            if (handshake::queue)
+                handshake::kick();
+            while (collector::epoch == e) {
+                if (gc_requested() && COMPARE_AND_SWAP(&collector::owner, 0, 1))
+                    collector::collect();
+                else
+                    futex::wait(&collector::epoch, e);
+            }
+            e = collector::epoch;
+            // A handshake requester may be running on our behalf.
+            while (!COMPARE_AND_SWAP(&state, PARKED, RUNNING))
+                futex::wait(&state, HANDSHAKING);
+        } while (gc_requested());
+    }
+
+    void wait_for_collector(GVMT_StackItem* sp, GVMT_Frame fp) {
+        gvmt_stack_pointer = sp;
+        gvmt_frame_pointer = fp;
+        scan_own_stack();
+        block(collector::epoch);
+        assert(gvmt_gc_limit_pointer == 0);
+        assert(gvmt_gc_free_pointer >= gvmt_gc_limit_pointer);
+        scanned_roots->valid = false;
+    }
+
+    inline void exit_native(void) {
+        int32_t e = collector::epoch;
+        // A handshake requester may be running on our behalf.
+        while (!COMPARE_AND_SWAP(&state, NATIVE, RUNNING))
+            futex::wait(&state, HANDSHAKING);
+        if (gc_requested())
+            block(e);
+    }
+
+    inline void enter_native(void) {
+        set_state(NATIVE);
+        // Requester may have missed us, see handshake::request.
+        if (handshake::queue)
+            handshake::kick();
+    }
+
+}
+
+#elif HAVE_COMPARE_AND_SWAP
 
 namespace mutator {
     
@@ -239,6 +524,7 @@ namespace mutator {
     void wait_for_collector(GVMT_StackItem* sp, GVMT_Frame fp) {
         gvmt_stack_pointer = sp;
         gvmt_frame_pointer = fp;
+        scan_own_stack();
         int rt;
         do {
             rt = mutator::threads;
@@ -250,11 +536,12 @@ namespace mutator {
         }
         do {
             pthread_cond_wait(&collector::done, &collector::lock);
-        } while (gvmt_gc_waiting);
+        } while (mutator::gc_requested());
         pthread_mutex_unlock(&collector::lock);   
         increment_rt_count();
         assert(gvmt_gc_limit_pointer == 0);
         assert(gvmt_gc_free_pointer >= gvmt_gc_limit_pointer);
+        scanned_roots->valid = false;
     }
     
 }
@@ -284,6 +571,7 @@ namespace mutator {
     void wait_for_collector(GVMT_StackItem* sp, GVMT_Frame fp) {
         gvmt_stack_pointer = sp;
         gvmt_frame_pointer = fp;
+        scan_own_stack();
         pthread_mutex_lock(&collector::lock);
         mutator::threads--;
         if (mutator::threads == 0) {
@@ -291,17 +579,207 @@ namespace mutator {
         }
         do {
             pthread_cond_wait(&collector::done, &collector::lock);
-        } while (gvmt_gc_waiting);
+        } while (mutator::gc_requested());
         mutator::threads++;
         pthread_mutex_unlock(&collector::lock);   
         assert(gvmt_gc_limit_pointer == 0);
         assert(gvmt_gc_free_pointer >= gvmt_gc_limit_pointer);
+        scanned_roots->valid = false;
     }
     
 }
 
 #endif
 
+/** Thread-local handshakes.
+ * A handshake runs a closure once for each target thread, without stopping
+ * the world. The target runs it itself at its next call to
+ * gvmt_gc_safe_point(), or on entering or leaving native code.
+ * For code compiled with -P, that means at the next collection or native
+ * call, as polling safe points do not see GVMT_WAITING_HANDSHAKE.
+ * With the futex handshake, a target that is in native code, or parked
+ * waiting for the collector, has its handshakes run by the requester, 
+ * while it is held out of GVMT code.
+ * Otherwise the requester waits for the target to return from native code.
+ * The requester waits on its targets only, and must itself be in native code.
+ */
+namespace handshake {
+
+    struct Request {
+        gvmt_handshake_func func;
+        void* arg;
+        volatile int32_t remaining;
+    };
+
+    struct Entry {
+        Request* request;
+        int32_t thread_id;
+        Entry* next;
+    };
+
+    struct Thread {
+        int32_t id;
+        Entry* volatile* queue;
+#if GVMT_FUTEX_HANDSHAKE
+        volatile int32_t* state;
+#endif
+    };
+
+    GVMT_THREAD_LOCAL Entry* volatile queue = NULL;
+    /** All GVMT threads, protected by collector::lock */
+    std::vector<Thread> threads;
+    /** Number of posted handshakes not yet run, by all threads */
+    volatile int32_t outstanding = 0;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+    /** Incremented (under lock) whenever requesters should look again */
+    int32_t kicks = 0;
+
+    void kick(void) {
+        pthread_mutex_lock(&lock);
+        kicks++;
+        pthread_cond_broadcast(&done);
+        pthread_mutex_unlock(&lock);
+    }
+
+    void complete(Request* r) {
+        // r may be freed as soon as remaining reaches zero.
+        if (__sync_sub_and_fetch(&r->remaining, 1) == 0)
+            kick();
+        if (__sync_sub_and_fetch(&outstanding, 1) == 0) {
+            __sync_fetch_and_and(&gvmt_gc_waiting, ~GVMT_WAITING_HANDSHAKE);
+            // Another handshake may have been posted in the meantime.
+            if (outstanding)
+                __sync_fetch_and_or(&gvmt_gc_waiting, GVMT_WAITING_HANDSHAKE);
+        }
+    }
+
+    void run_queue(Entry* volatile* q) {
+        Entry* e = __sync_lock_test_and_set(q, (Entry*)NULL);
+        // Entries are pushed on the front, run them in the order posted.
+        Entry* ordered = NULL;
+        while (e) {
+            Entry* next = e->next;
+            e->next = ordered;
+            ordered = e;
+            e = next;
+        }
+        while (ordered) {
+            Entry* next = ordered->next;
+            ordered->request->func(ordered->thread_id, ordered->request->arg);
+            complete(ordered->request);
+            delete ordered;
+            ordered = next;
+        }
+    }
+
+    void run(void) {
+        run_queue(&queue);
+    }
+
+    void post(Thread& t, Request* r) {
+        Entry* e = new Entry;
+        e->request = r;
+        e->thread_id = t.id;
+        Entry* head;
+        do {
+            head = *t.queue;
+            e->next = head;
+        } while (!COMPARE_AND_SWAP(t.queue, head, e));
+    }
+
+#if GVMT_FUTEX_HANDSHAKE
+
+    /** Run handshakes for targets in native code, or parked waiting for
+     * the collector, on their behalf. Returns false if a collection 
+     * prevented this. */
+    bool help(std::vector<Thread>& targets) {
+        bool ok = true;
+        int32_t s;
+        std::vector<Thread>::iterator it;
+        for (it = targets.begin(); it != targets.end(); it++) {
+            if (*it->queue == NULL)
+                continue;
+            s = *it->state;
+            if (s != mutator::NATIVE && s != mutator::PARKED)
+                continue;
+            if (!COMPARE_AND_SWAP(it->state, s, mutator::HANDSHAKING))
+                continue;
+            // The collector may already have passed this thread.
+            if (mutator::gc_requested())
+                ok = false;
+            else
+                run_queue(it->queue);
+            *it->state = s;
+            __sync_synchronize();
+            futex::wake(it->state, INT_MAX);
+        }
+        return ok;
+    }
+
+#endif
+
+    void request(std::vector<Thread>& targets, gvmt_handshake_func func, void* arg) {
+        if (targets.empty())
+            return;
+        Request r;
+        r.func = func;
+        r.arg = arg;
+        r.remaining = targets.size();
+        __sync_fetch_and_add(&outstanding, targets.size());
+        std::vector<Thread>::iterator it;
+        for (it = targets.begin(); it != targets.end(); it++)
+            post(*it, &r);
+        __sync_fetch_and_or(&gvmt_gc_waiting, GVMT_WAITING_HANDSHAKE);
+        pthread_mutex_lock(&lock);
+        while (r.remaining) {
+#if GVMT_FUTEX_HANDSHAKE
+            // Posting is a full barrier, so either we see a target in native
+            // code or parked here, or it sees its queue after entering native
+            // code or parking and kicks us.
+            int32_t k = kicks;
+            int32_t e = collector::epoch;
+            pthread_mutex_unlock(&lock);
+            if (!help(targets)) {
+                while (collector::epoch == e)
+                    futex::wait(&collector::epoch, e);
+            }
+            pthread_mutex_lock(&lock);
+            if (r.remaining == 0 || kicks != k)
+                continue;
+#endif
+            pthread_cond_wait(&done, &lock);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    void add_thread(void) {
+        Thread t;
+        t.id = gvmt_thread_id;
+        t.queue = &queue;
+#if GVMT_FUTEX_HANDSHAKE
+        t.state = &mutator::state;
+#endif
+        threads.push_back(t);
+    }
+
+    /** Threads other than the caller, that are thread_id, or all if -1 */
+    std::vector<Thread> targets(int32_t thread_id) {
+        std::vector<Thread> result;
+        pthread_mutex_lock(&collector::lock);
+        std::vector<Thread>::iterator it;
+        for (it = threads.begin(); it != threads.end(); it++) {
+            if (it->queue == &queue)
+                continue;
+            if (thread_id == -1 || it->id == thread_id)
+                result.push_back(*it);
+        }
+        pthread_mutex_unlock(&collector::lock);
+        return result;
+    }
+
+}
+
 extern "C" {
 
     /** Functions to assist thread-stupid debuggers ;) */
@@ -345,47 +823,139 @@ namespace allocator {
     pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
     char* free;
     char* limit;
+    GVMT_THREAD_LOCAL Stats stats = { 0, GVMT_ALLOCATOR_BLOCK_SIZE, 0, 0, 0, 0, 0 };
+    /** Stats of all GVMT threads, protected by collector::lock */
+    std::vector<Stats*> thread_stats;
+    int max_chunk_size = GVMT_ALLOCATOR_MAX_CHUNK_SIZE;
+    int64_t interval_start = 0;
 
+    /** Take size bytes from the shared space, or NULL if there is not enough */
 #if HAVE_COMPARE_AND_SWAP
 
-    char* get_block(GVMT_StackItem* sp, GVMT_Frame fp, int size) {
+    char* take(int size) {
         char* block;
-        char* new_free;
         do {
             block = free;
-            new_free = block + size;
-            while (new_free > limit) {
-                mutator::request_gc();
-                mutator::wait_for_collector(sp, fp);
-                block = free;
-                new_free = block + size;
-            }
-        } while (!COMPARE_AND_SWAP(&free, block, new_free));
+            if (limit - block < size)
+                return NULL;
+        } while (!COMPARE_AND_SWAP(&free, block, block + size));
         return block;
     }
     
 #else
 
+    char* take(int size) {
+        char* block = NULL;
+        pthread_mutex_lock(&lock);
+        if (limit - free >= size) {
+            block = free;
+            free += size;
+        }
+        pthread_mutex_unlock(&lock);
+        return block;
+    }
+    
+#endif
+
+#if GVMT_PER_CPU_CACHES
+
+    /** Per-CPU chunk caches.
+     * Small chunks are carved from a cache for the current CPU, which takes
+     * GVMT_ALLOCATOR_CPU_CHUNK_SIZE bytes at a time from the shared space.
+     * Each cache has its own cache line, and its lock is only contended by 
+     * threads that have run on the same CPU. */
+    struct CpuCache {
+        volatile int32_t lock;
+        char* free;
+        char* limit;
+    } __attribute__((aligned(64)));
+
+    CpuCache caches[GVMT_ALLOCATOR_MAX_CPUS];
+    
+    char* take_cached(int size) {
+        if (size*4 > GVMT_ALLOCATOR_CPU_CHUNK_SIZE)
+            return take(size);
+        CpuCache* cache = &caches[sched_getcpu() & (GVMT_ALLOCATOR_MAX_CPUS-1)];
+        while (!COMPARE_AND_SWAP(&cache->lock, 0, 1))
+            sched_yield();
+        char* block;
+        if (cache->limit - cache->free >= size) {
+            block = cache->free;
+            cache->free += size;
+        } else if ((block = take(GVMT_ALLOCATOR_CPU_CHUNK_SIZE)) != NULL) {
+            // Any remainder of the old piece is wasted, as for thread chunks.
+            cache->free = block + size;
+            cache->limit = block + GVMT_ALLOCATOR_CPU_CHUNK_SIZE;
+        } else {
+            block = take(size);
+        }
+        __sync_lock_release(&cache->lock);
+        return block;
+    }
+    
+    void empty_caches(void) {
+        for (int i = 0; i < GVMT_ALLOCATOR_MAX_CPUS; i++) {
+            caches[i].free = caches[i].limit = NULL;
+        }
+    }
+    
+#else
+
+    inline char* take_cached(int size) {
+        return take(size);
+    }
+    
+    inline void empty_caches(void) {
+    }
+    
+#endif
+
     char* get_block(GVMT_StackItem* sp, GVMT_Frame fp, int size) {
         char* block;
-        if (gvmt_gc_waiting)
-            mutator::wait_for_collector(sp, fp);
-        pthread_mutex_lock(&lock);
-        if (free + size > limit) {
+        while ((block = take_cached(size)) == NULL) {
             // Need to stop all threads.
-            pthread_mutex_unlock(&lock);
             mutator::request_gc();
             mutator::wait_for_collector(sp, fp);
-            pthread_mutex_lock(&lock);
         }
-        assert(free + size < limit);
-        block = free;
-        free += size;
-        pthread_mutex_unlock(&lock);
         return block;
     }
     
-#endif
+    void end_interval(void) {
+        int64_t now = high_res_time();
+        int64_t elapsed = now - interval_start;
+        interval_start = now;
+        // Bound the space that unused chunk ends can waste to 1/16th.
+        size_t threads = thread_stats.empty() ? 1 : thread_stats.size();
+        size_t space = limit > free ? limit - free : 0;
+        size_t cap = (space / (16 * threads)) & (~(GVMT_ALLOCATOR_PAGE_SIZE-1));
+        if (cap < GVMT_ALLOCATOR_PAGE_SIZE)
+            cap = GVMT_ALLOCATOR_PAGE_SIZE;
+        if (cap > GVMT_ALLOCATOR_MAX_CHUNK_SIZE)
+            cap = GVMT_ALLOCATOR_MAX_CHUNK_SIZE;
+        max_chunk_size = cap;
+        std::vector<Stats*>::iterator it;
+        for (it = thread_stats.begin(); it != thread_stats.end(); it++) {
+            Stats* s = *it;
+            if (elapsed > 0)
+                s->rate = s->interval_bytes * 1000000000 / elapsed;
+            // Threads that took no more than one chunk are idle, shrink them.
+            if (s->interval_bytes <= (uint64_t)s->chunk_size && 
+                s->chunk_size > GVMT_ALLOCATOR_PAGE_SIZE)
+                s->chunk_size /= 2;
+            while (s->chunk_size > max_chunk_size)
+                s->chunk_size /= 2;
+            s->interval_bytes = 0;
+            s->refills = 0;
+        }
+        empty_caches();
+    }
+    
+    void add_thread(void) {
+        if (thread_stats.empty())
+            interval_start = high_res_time();
+        stats.thread_id = gvmt_thread_id;
+        thread_stats.push_back(&stats);
+    }
     
 }
 
@@ -418,6 +988,88 @@ namespace TLS {
     
 };
 
+/** Global roots, weak references and finalizables, without locking.
+ * Each thread hands out slots from its own blocks, taking a new block from
+ * the shared list (under collector::lock) only when its block is used up.
+ * Freed slots are zeroed and pushed on the freeing thread's own free list,
+ * so freeing is O(1) and lock-free. Unused slots are NULL, which the GC 
+ * ignores, so GC iteration over the lists is unchanged.
+ * Finalizables, and weak references as they are written, are buffered per 
+ * thread and moved to GC::finalizables and GC::young_weak_references with 
+ * the world stopped, before each collection. */
+namespace roots {
+
+    struct Slots {
+        GVMT_Object* next;
+        GVMT_Object* end;
+        std::vector<GVMT_Object*> free_list;
+        
+        Slots() : next(NULL), end(NULL) { }
+        
+        GVMT_Object* allocate(Root::List& list) {
+            if (!free_list.empty()) {
+                GVMT_Object* slot = free_list.back();
+                free_list.pop_back();
+                return slot;
+            }
+            if (next == end) {
+                pthread_mutex_lock(&collector::lock);
+                Root::Block* b = list.addBlock();
+                pthread_mutex_unlock(&collector::lock);
+                next = b->start;
+                end = b->end;
+            }
+            return next++;
+        }
+        
+        void release(GVMT_Object* slot) {
+            *slot = NULL;
+            free_list.push_back(slot);
+        }
+    };
+    
+    GVMT_THREAD_LOCAL Slots* strong = NULL;
+    GVMT_THREAD_LOCAL Slots* weak = NULL;
+    struct Buffers {
+        std::vector<GVMT_Object> finalizables;
+        std::vector<GVMT_Object*> weak_writes;
+    };
+    
+    GVMT_THREAD_LOCAL Buffers* buffers = NULL;
+    /** Buffers of all threads, protected by collector::lock */
+    std::vector<Buffers*> all_buffers;
+    
+    inline Slots* get(Slots*& slots) {
+        if (slots == NULL)
+            slots = new Slots();
+        return slots;
+    }
+    
+    inline Buffers* get_buffers(void) {
+        if (buffers == NULL) {
+            buffers = new Buffers();
+            pthread_mutex_lock(&collector::lock);
+            all_buffers.push_back(buffers);
+            pthread_mutex_unlock(&collector::lock);
+        }
+        return buffers;
+    }
+    
+    void flush(void) {
+        std::vector<Buffers*>::iterator it;
+        for (it = all_buffers.begin(); it != all_buffers.end(); it++) {
+            Buffers* b = *it;
+            GC::finalizables.insert(GC::finalizables.end(), 
+                                    b->finalizables.begin(), b->finalizables.end());
+            b->finalizables.clear();
+            GC::young_weak_references.insert(GC::young_weak_references.end(), 
+                                    b->weak_writes.begin(), b->weak_writes.end());
+            b->weak_writes.clear();
+        }
+    }
+
+}
+
 /** GVMT GC interface */
 extern "C" {
     
@@ -430,14 +1082,21 @@ extern "C" {
     }
     
     void gvmt_gc_safe_point(GVMT_StackItem* sp, GVMT_Frame fp) {
-        if (gvmt_gc_waiting) {
+        if (handshake::queue) {
+            gvmt_stack_pointer = sp;
+            gvmt_frame_pointer = fp;
+            handshake::run();
+        }
+        if (mutator::gc_requested()) {
             mutator::wait_for_collector(sp, fp);
+            handshake::poll();
         }
     }
         
     GVMT_StackItem* gvmt_exit_native(void) {
         gvmt_thread_non_native = 1;
-        mutator::increment_rt_count();
+        mutator::exit_native();
+        handshake::poll();
         return gvmt_stack_pointer;
     }
      
@@ -445,42 +1104,64 @@ extern "C" {
         gvmt_thread_non_native = 0;
         gvmt_stack_pointer = sp;
         gvmt_frame_pointer = fp;
-        mutator::decrement_rt_count();
+        handshake::poll();
+        mutator::enter_native();
     }
     
-    /** GVMT GC interface */
-    void *gvmt_gc_add_root(void) {
+    void gvmt_handshake(int32_t thread_id, gvmt_handshake_func func, void* arg) {
+        std::vector<handshake::Thread> targets = handshake::targets(thread_id);
+        handshake::request(targets, func, arg);
+        if (thread_id == gvmt_thread_id)
+            func(thread_id, arg);
+    }
+    
+    void gvmt_handshake_all(gvmt_handshake_func func, void* arg) {
+        std::vector<handshake::Thread> targets = handshake::targets(-1);
+        handshake::request(targets, func, arg);
+    }
+    
+    int gvmt_allocation_stats(GVMT_AllocationStats* stats, int max) {
         pthread_mutex_lock(&collector::lock);
-        GVMT_Object* root = Root::GC_ROOTS.addRoot(NULL);
+        int count = allocator::thread_stats.size();
+        for (int i = 0; i < count && i < max; i++) {
+            allocator::Stats* s = allocator::thread_stats[i];
+            stats[i].thread_id = s->thread_id;
+            stats[i].chunk_size = s->chunk_size;
+            stats[i].bytes = s->bytes;
+            stats[i].chunks = s->chunks;
+            stats[i].rate = s->rate;
+        }
         pthread_mutex_unlock(&collector::lock);
-        return root;
+        return count;
+    }
+    
+    /** GVMT GC interface */
+    void *gvmt_gc_add_root(void) {
+        return roots::get(roots::strong)->allocate(Root::GC_ROOTS);
     }
 
     GVMT_LINKAGE_1(gvmt_gc_free_root, void* ref) 
-        pthread_mutex_lock(&collector::lock);
-        Root::GC_ROOTS.free((GVMT_Object*)ref);
-        pthread_mutex_unlock(&collector::lock);
+        roots::get(roots::strong)->release((GVMT_Object*)ref);
         GVMT_RETURN_V;
     }
 
     GVMT_LINKAGE_1(gvmt_gc_finalizable, void* obj)
-        pthread_mutex_lock(&collector::lock);
-        GC::finalizables.push_back((GVMT_Object)obj);
-        pthread_mutex_unlock(&collector::lock);
+        roots::get_buffers()->finalizables.push_back((GVMT_Object)obj);
         GVMT_RETURN_V;
     }
     
     void* gvmt_gc_weak_reference(void) {
-        pthread_mutex_lock(&collector::lock);
-        void* ref = (void*)GC::weak_references.addRoot(NULL);
-        pthread_mutex_unlock(&collector::lock);
-        return ref;
+        return roots::get(roots::weak)->allocate(GC::weak_references);
     }
 
     GVMT_LINKAGE_1(gvmt_free_weak_reference, void* ref) 
-        pthread_mutex_lock(&collector::lock);
-        GC::weak_references.free((GVMT_Object*)ref);
-        pthread_mutex_unlock(&collector::lock);
+        roots::get(roots::weak)->release((GVMT_Object*)ref);
+        GVMT_RETURN_V;
+    }
+    
+    GVMT_LINKAGE_2(gvmt_gc_write_weak_reference, void* ref, void* obj)
+        *((GVMT_Object*)ref) = (GVMT_Object)obj;
+        roots::get_buffers()->weak_writes.push_back((GVMT_Object*)ref);
         GVMT_RETURN_V;
     }
 
@@ -488,10 +1169,17 @@ extern "C" {
         pthread_mutex_lock(&collector::lock);
         GC::stacks.push_back(Stack(gvmt_stack_base, &gvmt_stack_pointer));
         GC::frames.push_back(FrameStack(&gvmt_frame_pointer));
+#if GVMT_FUTEX_HANDSHAKE
+        mutator::states.push_back(&mutator::state);
+#endif
+        handshake::add_thread();
+        mutator::scanned_roots = new ScannedRoots();
+        GC::scanned_roots.push_back(mutator::scanned_roots);
         TLS::arrays.push_back(&TLS::array);
         TLS::array = (GVMT_Object*)malloc(sizeof(GVMT_Object*) * TLS::array_size);
         allocator::local_limits.push_back(&gvmt_gc_limit_pointer);
         allocator::free_pointers.push_back(&gvmt_gc_free_pointer);
+        allocator::add_thread();
         pthread_mutex_unlock(&collector::lock);
         gvmt_gc_free_pointer = gvmt_gc_limit_pointer = 0;
     }
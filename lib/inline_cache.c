@@ -0,0 +1,59 @@
+#include <string.h>
+#include "gvmt/internal/core.h"
+#include <pthread.h>
+
+/* Inline caches, for GVMT_INLINE_CACHE.
+ * Interpreters record the keys seen at each site, and their targets.
+ * The generated compiler reads them, and calls the targets directly,
+ * guarded by a test of the key.
+ * Updates are locked, so the compiler always sees a key with its own target.
+ * Interpreters read the table without locking, but only to avoid a miss.
+ */
+
+struct gvmt_inline_cache gvmt_inline_caches[GVMT_INLINE_CACHES];
+
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void gvmt_inline_cache_miss(void* ip, void* key, intptr_t offset, int ways) {
+    struct gvmt_inline_cache* cache = &gvmt_inline_caches[GVMT_INLINE_CACHE_INDEX(ip, offset)];
+    int i;
+    assert(ways > 0 && ways <= GVMT_CACHE_WAYS);
+    pthread_mutex_lock(&caches_lock);
+    if (cache->ip != ip || cache->offset != offset) {
+        // Evict the previous site.
+        memset(cache, 0, sizeof(struct gvmt_inline_cache));
+        cache->ip = ip;
+        cache->offset = offset;
+    }
+    if (cache->count != GVMT_MEGAMORPHIC) {
+        for (i = 0; i < cache->count; i++) {
+            if (cache->keys[i] == key)
+                break;
+        }
+        if (i == cache->count) {
+            if (i < ways) {
+                cache->keys[i] = key;
+                cache->targets[i] = *(void**)(((char*)key) + offset);
+                cache->count = i + 1;
+            } else {
+                cache->count = GVMT_MEGAMORPHIC;
+            }
+        }
+    }
+    pthread_mutex_unlock(&caches_lock);
+}
+
+int gvmt_inline_cache_read(void* ip, intptr_t offset, void** keys, void** targets) {
+    struct gvmt_inline_cache* cache = &gvmt_inline_caches[GVMT_INLINE_CACHE_INDEX(ip, offset)];
+    int i, count = 0;
+    pthread_mutex_lock(&caches_lock);
+    if (cache->ip == ip && cache->offset == offset) {
+        count = cache->count;
+        for (i = 0; i < count; i++) {
+            keys[i] = cache->keys[i];
+            targets[i] = cache->targets[i];
+        }
+    }
+    pthread_mutex_unlock(&caches_lock);
+    return count;
+}
@@ -73,6 +73,11 @@ GVMT_LINKAGE_1(gvmt_gc_free_weak_reference, GVMT_Object* ref)
     GVMT_RETURN_V;
 }
 
+GVMT_LINKAGE_2(gvmt_gc_write_weak_reference, GVMT_Object* ref, GVMT_Object obj)
+    *ref = obj;
+    GVMT_RETURN_V;
+}
+
 void inform_gc_new_stack(void) {
     // Don't need to do anything for single-threaded code.
 }
@@ -97,6 +102,15 @@ GVMT_CALL void* gvmt_gc_pin(GVMT_Object obj) {
     return obj;
 }
 
+GVMT_LINKAGE_1(gvmt_gc_unpin, void* obj)
+    (void)obj;
+    GVMT_RETURN_V;
+}
+
+GVMT_LINKAGE_1(gvmt_malloc_pinned, void* size)
+    GVMT_RETURN_R(gvmt_none_malloc(gvmt_sp, fp, (size_t)size));
+}
+
 int gvmt_is_pinned(void* ptr) {
     return 1;
 }
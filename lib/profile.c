@@ -0,0 +1,254 @@
+#define _XOPEN_SOURCE 600
+#include <stdlib.h>
+#include "gvmt/internal/core.h"
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+
+/* Instruction sequence profiling, for interpreters built with gvmtas -S.
+ * Counts pairs and triples of instructions that are executed one after
+ * the other and are also adjacent in the bytecode. These are the sequences
+ * that can be replaced by superinstructions (gvmtic -p).
+ * The profile is written at exit to $GVMT_PROFILE, or gvmt.profile.
+ * Counts are not synchronised, so may be a little low for threaded programs.
+ */
+
+#define TRIPLES (1 << 16)
+#define MAX_PROBES 16
+
+static uint32_t pairs[256][256];
+static uint32_t triple_keys[TRIPLES];
+static uint32_t triple_counts[TRIPLES];
+static char** opcode_names;
+static void* expected_ip;
+static int previous[2];
+// Length of the current run of adjacent instructions, up to 2.
+static int run;
+
+static void count_triple(int a, int b, int c) {
+    uint32_t key = (1 << 24) | (a << 16) | (b << 8) | c;
+    uint32_t index = (key * 2654435761u) >> 16;
+    int i;
+    // Linear probing, give up if the table is crowded.
+    for (i = 0; i < MAX_PROBES; i++) {
+        index &= TRIPLES - 1;
+        if (triple_keys[index] == key) {
+            triple_counts[index]++;
+            return;
+        }
+        if (triple_keys[index] == 0) {
+            triple_keys[index] = key;
+            triple_counts[index] = 1;
+            return;
+        }
+        index++;
+    }
+}
+
+static void write_profile(void) {
+    char* name = getenv("GVMT_PROFILE");
+    FILE* out;
+    int a, b, i;
+    if (name == NULL)
+        name = "gvmt.profile";
+    out = fopen(name, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Cannot write profile to %s\n", name);
+        return;
+    }
+    fprintf(out, "# count instructions\n");
+    for (a = 0; a < 256; a++) {
+        for (b = 0; b < 256; b++) {
+            if (pairs[a][b])
+                fprintf(out, "%u %s %s\n", pairs[a][b],
+                        opcode_names[a], opcode_names[b]);
+        }
+    }
+    for (i = 0; i < TRIPLES; i++) {
+        uint32_t key = triple_keys[i];
+        if (key)
+            fprintf(out, "%u %s %s %s\n", triple_counts[i],
+                    opcode_names[(key >> 16) & 0xff],
+                    opcode_names[(key >> 8) & 0xff],
+                    opcode_names[key & 0xff]);
+    }
+    fclose(out);
+}
+
+void gvmt_profile_sequence(void* ip, void* next, int opcode, char** names) {
+    if (opcode_names == NULL) {
+        opcode_names = names;
+        atexit(write_profile);
+    }
+    if (ip == expected_ip) {
+        pairs[previous[1]][opcode]++;
+        if (run == 2)
+            count_triple(previous[0], previous[1], opcode);
+        else
+            run = 2;
+    } else {
+        run = 1;
+    }
+    previous[0] = previous[1];
+    previous[1] = opcode;
+    expected_ip = next;
+}
+
+/* Opcode profiling, for interpreters built with gvmtas -Q.
+ * Each thread counts into its own profile, so there is no contention.
+ * Profiles are never freed, so the counts of finished threads are kept.
+ * The profile is written at exit to $GVMT_OPCODE_PROFILE, or gvmt.opcodes.
+ */
+
+GVMT_THREAD_LOCAL struct gvmt_opcode_profile* gvmt_opcode_profile;
+
+static struct gvmt_opcode_profile* opcode_profiles;
+static char** profiled_names;
+static pthread_mutex_t profiles_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Totals over all threads, shared by writers, so protected by write_lock.
+static uint64_t total_counts[256];
+static uint64_t total_cycles[256];
+static uint64_t total_pairs[256 * 256];
+static int order[256 * 256];
+
+static int by_count(const void* x, const void* y) {
+    uint64_t a = total_counts[*(const int*)x];
+    uint64_t b = total_counts[*(const int*)y];
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+static int by_pair_count(const void* x, const void* y) {
+    uint64_t a = total_pairs[*(const int*)x];
+    uint64_t b = total_pairs[*(const int*)y];
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+void gvmt_write_opcode_profile(const char* filename) {
+    struct gvmt_opcode_profile* p;
+    uint64_t executed = 0;
+    FILE* out;
+    int i, n;
+    if (profiled_names == NULL)
+        return;
+    if (filename == NULL)
+        filename = getenv("GVMT_OPCODE_PROFILE");
+    if (filename == NULL)
+        filename = "gvmt.opcodes";
+    pthread_mutex_lock(&write_lock);
+    out = fopen(filename, "w");
+    if (out == NULL) {
+        pthread_mutex_unlock(&write_lock);
+        fprintf(stderr, "Cannot write opcode profile to %s\n", filename);
+        return;
+    }
+    // Counts are read unsynchronised, so may be slightly out of date.
+    for (i = 0; i < 256; i++)
+        total_counts[i] = total_cycles[i] = 0;
+    for (i = 0; i < 256 * 256; i++)
+        total_pairs[i] = 0;
+    for (p = opcode_profiles; p; p = p->next) {
+        for (i = 0; i < 256; i++) {
+            total_counts[i] += p->counts[i];
+            total_cycles[i] += p->cycles[i];
+        }
+        for (i = 0; i < 256 * 256; i++)
+            total_pairs[i] += p->pairs[i >> 8][i & 255];
+    }
+    for (i = 0; i < 256; i++) {
+        executed += total_counts[i];
+        order[i] = i;
+    }
+    qsort(order, 256, sizeof(int), by_count);
+    fprintf(out, "# count percent cycles cycles/execution opcode\n");
+    for (i = 0; i < 256 && total_counts[order[i]]; i++) {
+        int op = order[i];
+        fprintf(out, "%llu %.2f %llu %llu %s\n",
+                (unsigned long long)total_counts[op],
+                100.0 * total_counts[op] / executed,
+                (unsigned long long)total_cycles[op],
+                (unsigned long long)(total_cycles[op] / total_counts[op]),
+                profiled_names[op]);
+    }
+    n = 0;
+    for (i = 0; i < 256 * 256; i++) {
+        if (total_pairs[i])
+            order[n++] = i;
+    }
+    qsort(order, n, sizeof(int), by_pair_count);
+    fprintf(out, "# count first second\n");
+    for (i = 0; i < n; i++) {
+        int pair = order[i];
+        fprintf(out, "%llu %s %s\n", (unsigned long long)total_pairs[pair],
+                profiled_names[pair >> 8], profiled_names[pair & 255]);
+    }
+    fclose(out);
+    pthread_mutex_unlock(&write_lock);
+}
+
+static void write_at_exit(void) {
+    gvmt_write_opcode_profile(NULL);
+}
+
+struct gvmt_opcode_profile* gvmt_opcode_profile_start(char** names) {
+    struct gvmt_opcode_profile* p = calloc(1, sizeof(struct gvmt_opcode_profile));
+    if (p == NULL)
+        __gvmt_fatal("Out of memory for opcode profile\n");
+    p->previous = 256;
+    p->last_cycles = gvmt_cycle_count();
+    pthread_mutex_lock(&profiles_lock);
+    if (profiled_names == NULL) {
+        profiled_names = names;
+        atexit(write_at_exit);
+    }
+    p->next = opcode_profiles;
+    opcode_profiles = p;
+    pthread_mutex_unlock(&profiles_lock);
+    gvmt_opcode_profile = p;
+    return p;
+}
+
+/* Writing the profile is not async-signal-safe, so the signal handler
+ * just posts a semaphore, and a helper thread does the writing. */
+static sem_t write_requested;
+static int writer_started;
+
+static void* writer(void* arg) {
+    sigset_t signal_mask;
+    // Leave signals to the other threads.
+    sigfillset(&signal_mask);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, NULL);
+    while (1) {
+        while (sem_wait(&write_requested) != 0 && errno == EINTR)
+            ;
+        gvmt_write_opcode_profile(NULL);
+    }
+    return NULL;
+}
+
+static void write_on_signal(int sig) {
+    int saved_errno = errno;
+    sem_post(&write_requested);
+    errno = saved_errno;
+}
+
+void gvmt_opcode_profile_on_signal(int sig) {
+    struct sigaction action;
+    pthread_t thread;
+    pthread_mutex_lock(&profiles_lock);
+    if (!writer_started) {
+        if (sem_init(&write_requested, 0, 0) ||
+            pthread_create(&thread, NULL, writer, NULL))
+            __gvmt_fatal("Cannot start opcode profile writer\n");
+        pthread_detach(thread);
+        writer_started = 1;
+    }
+    pthread_mutex_unlock(&profiles_lock);
+    action.sa_handler = write_on_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(sig, &action, NULL);
+}
@@ -0,0 +1,210 @@
+#define _XOPEN_SOURCE 600
+#include <stdlib.h>
+#include <string.h>
+#include "gvmt/internal/core.h"
+#include <pthread.h>
+#include <signal.h>
+
+/* Tiered compilation, for interpreters built with gvmtas -J.
+ * The interpreter counts entries and backward jumps for each registered
+ * block of bytecodes, and records type feedback for it. Hot blocks are 
+ * queued, and compiled one at a time by a background thread, so the 
+ * interpreter keeps running meanwhile.
+ * A hot loop also gets an entry point at its header, so that an interpreter
+ * already running it can continue in compiled code (on-stack replacement).
+ * Code that deoptimises is discarded, and recompiled with the new feedback.
+ * The compiler thread is not a GVMT thread, so must not touch the heap.
+ * Counts are not synchronised, so may be a little low for threaded programs.
+ */
+
+struct gvmt_tier* volatile gvmt_tiers[GVMT_TIERS];
+
+uint32_t gvmt_tier_threshold = 1000;
+
+typedef void* (*compile_func)(uint8_t* begin, uint8_t* end, char* name);
+typedef void* (*compile_osr_func)(uint8_t* begin, uint8_t* end, 
+                                  uint8_t* entry, char* name);
+
+static compile_func compile_function;
+static compile_osr_func compile_osr_function;
+static pthread_mutex_t tiers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static struct gvmt_tier* queue_head;
+static struct gvmt_tier* queue_tail;
+/** The tier being compiled, protected by tiers_lock */
+static struct gvmt_tier* compiling;
+
+static void* compiler_thread(void* arg) {
+    sigset_t signal_mask;
+    struct gvmt_tier* tier;
+    int compile, compile_osr;
+    void* code;
+    // Leave signals to the GVMT threads.
+    sigfillset(&signal_mask);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, NULL);
+    while (1) {
+        pthread_mutex_lock(&tiers_lock);
+        while (queue_head == NULL)
+            pthread_cond_wait(&queue_not_empty, &tiers_lock);
+        tier = queue_head;
+        queue_head = tier->next;
+        if (queue_head == NULL)
+            queue_tail = NULL;
+        tier->queued = 0;
+        compiling = tier;
+        compile = tier->state == GVMT_TIER_QUEUED;
+        compile_osr = tier->osr_state == GVMT_TIER_QUEUED;
+        pthread_mutex_unlock(&tiers_lock);
+        if (compile) {
+            code = compile_function(tier->begin, tier->end, tier->name);
+            // Make sure the code is complete before it is published.
+            __sync_synchronize();
+            tier->code = code;
+            tier->state = GVMT_TIER_COMPILED;
+        }
+        if (compile_osr) {
+            code = compile_osr_function(tier->begin, tier->end, 
+                                        tier->osr_ip, tier->name);
+            __sync_synchronize();
+            tier->osr_code = (gvmt_funcptr)code;
+            tier->osr_state = GVMT_TIER_COMPILED;
+        }
+        pthread_mutex_lock(&tiers_lock);
+        compiling = NULL;
+        pthread_mutex_unlock(&tiers_lock);
+    }
+    return NULL;
+}
+
+void gvmt_tiered_init(uint32_t threshold, compile_func compile, 
+                      compile_osr_func compile_osr) {
+    pthread_t thread;
+    char* value = getenv("GVMT_TIER_THRESHOLD");
+    if (value)
+        threshold = strtoul(value, NULL, 10);
+    if (threshold == 0)
+        threshold = 1;
+    pthread_mutex_lock(&tiers_lock);
+    if (compile_function == NULL) {
+        gvmt_tier_threshold = threshold;
+        compile_function = compile;
+        compile_osr_function = compile_osr;
+        if (pthread_create(&thread, NULL, compiler_thread, NULL))
+            __gvmt_fatal("Cannot start compiler thread\n");
+        pthread_detach(thread);
+    }
+    pthread_mutex_unlock(&tiers_lock);
+}
+
+void gvmt_tier_register(uint8_t* begin, uint8_t* end, char* name) {
+    struct gvmt_tier* tier;
+    int index = GVMT_TIER_INDEX(begin);
+    if (compile_function == NULL)
+        __gvmt_fatal("gvmt_tiered_init() must be called before gvmt_tier_register()\n");
+    pthread_mutex_lock(&tiers_lock);
+    if (gvmt_tier_lookup(begin) == NULL) {
+        tier = calloc(1, sizeof(struct gvmt_tier));
+        if (tier == NULL)
+            __gvmt_fatal("Out of memory for tiered compilation\n");
+        tier->begin = begin;
+        tier->end = end;
+        tier->name = malloc(strlen(name) + 1);
+        if (tier->name == NULL)
+            __gvmt_fatal("Out of memory for tiered compilation\n");
+        strcpy(tier->name, name);
+        tier->chain = gvmt_tiers[index];
+        // Interpreters read the table without locking.
+        __sync_synchronize();
+        gvmt_tiers[index] = tier;
+    }
+    pthread_mutex_unlock(&tiers_lock);
+}
+
+void gvmt_tier_hot(struct gvmt_tier* tier, uint8_t* osr_ip) {
+    pthread_mutex_lock(&tiers_lock);
+    if (tier->state == GVMT_TIER_INTERPRETED)
+        tier->state = GVMT_TIER_QUEUED;
+    // Only the first hot loop gets an entry point.
+    if (osr_ip && tier->osr_ip == NULL) {
+        tier->osr_ip = osr_ip;
+        if (compile_osr_function)
+            tier->osr_state = GVMT_TIER_QUEUED;
+        else  // No OSR, so osr_code stays NULL.
+            tier->osr_state = GVMT_TIER_COMPILED;
+    }
+    if (!tier->queued && (tier->state == GVMT_TIER_QUEUED || 
+                          tier->osr_state == GVMT_TIER_QUEUED)) {
+        tier->queued = 1;
+        tier->next = NULL;
+        if (queue_tail)
+            queue_tail->next = tier;
+        else
+            queue_head = tier;
+        queue_tail = tier;
+        pthread_cond_signal(&queue_not_empty);
+    }
+    pthread_mutex_unlock(&tiers_lock);
+}
+
+struct gvmt_feedback* gvmt_feedback_vector(struct gvmt_tier* tier) {
+    struct gvmt_feedback* vector;
+    pthread_mutex_lock(&tiers_lock);
+    if (tier->feedback == NULL) {
+        vector = calloc(tier->end - tier->begin, sizeof(struct gvmt_feedback));
+        if (vector == NULL)
+            __gvmt_fatal("Out of memory for tiered compilation\n");
+        tier->feedback = vector;
+    }
+    pthread_mutex_unlock(&tiers_lock);
+    return tier->feedback;
+}
+
+struct gvmt_tier* gvmt_tier_deoptimise(uint8_t* begin, uint8_t* ip) {
+    struct gvmt_tier* tier = gvmt_tier_lookup(begin);
+    struct gvmt_feedback* entry;
+    if (tier == NULL)
+        return NULL;
+    pthread_mutex_lock(&tiers_lock);
+    tier->deopts++;
+    if (tier->feedback && ip >= begin && ip < tier->end) {
+        entry = tier->feedback + (ip - begin);
+        if (entry->state == GVMT_FEEDBACK_MONOMORPHIC)
+            entry->state = GVMT_FEEDBACK_POLYMORPHIC;
+    }
+    // Leave the code alone if it is about to be replaced anyway.
+    if (tier->deopts <= GVMT_TIER_MAX_DEOPTS && !tier->queued && 
+        tier != compiling) {
+        tier->code = NULL;
+        tier->state = GVMT_TIER_INTERPRETED;
+        // Clear the code first, so the old entry is never used for a new ip.
+        tier->osr_code = NULL;
+        __sync_synchronize();
+        tier->osr_ip = NULL;
+        tier->osr_state = GVMT_TIER_INTERPRETED;
+        tier->count = 0;
+    }
+    pthread_mutex_unlock(&tiers_lock);
+    return tier;
+}
+
+int gvmt_feedback_read(uint8_t* begin, uint8_t* ip, uintptr_t* value) {
+    struct gvmt_tier* tier = gvmt_tier_lookup(begin);
+    struct gvmt_feedback* entry;
+    int state;
+    if (tier == NULL || tier->feedback == NULL || ip < begin || ip >= tier->end)
+        return GVMT_FEEDBACK_NONE;
+    entry = tier->feedback + (ip - begin);
+    state = entry->state;
+    // The value is written before the state.
+    __sync_synchronize();
+    if (state == GVMT_FEEDBACK_MONOMORPHIC)
+        *value = entry->value;
+    return state;
+}
+
+void* gvmt_tier_code(uint8_t* begin) {
+    struct gvmt_tier* tier = gvmt_tier_lookup(begin);
+    if (tier == NULL)
+        return NULL;
+    return tier->code;
+}
@@ -609,6 +609,25 @@ class GC_Malloc_Fast(Instruction):
          
     def process(self, mode):
         mode.stack_push(mode.gc_malloc_fast(mode.stack_pop(gtypes.uptr)))
+        
+class GC_Split(Instruction):
+    
+    def __init__(self):
+        self.name = 'GC_SPLIT'
+        self.inputs = [ 'region', 'offset' ]
+        self.outputs = [ 'ref' ]
+        self.__doc__ = ('Splits a new object off the region allocated by '
+                        'GC_MALLOC, leaving reference to the object offset '
+                        'bytes into region in TOS. Allows several objects to be '
+                        'allocated with a single GC_MALLOC. Offset must be '
+                        'pointer aligned and the region smaller than '
+                        'GVMT_MAX_REGION_SIZE. All objects must be split off '
+                        'and initialised before the next GC-safe point.')
+         
+    def process(self, mode):
+        offset = mode.stack_pop(gtypes.p)
+        region = mode.stack_pop(gtypes.p)
+        mode.stack_push(mode.binary(gtypes.p, region, operators.add, offset))
        
         
 class LAddr(Instruction):
@@ -678,7 +697,9 @@ class IP(Instruction):
         self.name = 'IP'
         self.inputs = []
         self.outputs = [ 'instruction_pointer' ]
-        self.__doc__ = 'Pushes the current (interpreter) instruction pointer to TOS.'
+        self.__doc__ = ('Pushes the current (interpreter) instruction pointer to TOS. '
+                        'With direct threading (gvmtas -D) this points to '
+                        'threaded code, one word per bytecode byte.')
         
     def process(self, mode):
         mode.stack_push(mode.ip())
@@ -984,6 +1005,55 @@ class FarJump(Instruction):
         ip = mode.stack_pop(gtypes.p)
         mode.far_jump(ip)
  
+class Quicken(Instruction):
+    
+    def __init__(self):
+        self.name = 'QUICKEN'
+        self.inputs = [ 'opcode' ]
+        self.outputs = [ ]
+        self.__doc__ = ('Replaces the opcode of the current instruction, in the '
+            'bytecode, with the opcode popped from the stack. The new '
+            'instruction must have the same length. A single store, so safe '
+            'if other threads are executing the same bytecode. '
+            'Only valid in an interpreter, does nothing in compiled code.')
+        
+    def process(self, mode):
+        mode.quicken(mode.stack_pop(gtypes.iptr))
+ 
+class InlineCache(Instruction):
+    
+    def __init__(self):
+        self.name = 'INLINE_CACHE'
+        self.inputs = [ 'ways', 'offset', 'key' ]
+        self.outputs = [ 'target' ]
+        self.__doc__ = ('Pushes the pointer at offset in key, usually a '
+            'method of a type. In an interpreter, the key is recorded in an '
+            'inline cache for this instruction, of up to ways keys. '
+            'Compiled code calls the targets of recorded keys directly. '
+            'Offset and ways must be constants, and the pointer at offset '
+            'in key must never change.')
+        
+    def process(self, mode):
+        key = mode.stack_pop(gtypes.p)
+        offset = mode.stack_pop(gtypes.iptr)
+        ways = mode.stack_pop(gtypes.iptr)
+        mode.stack_push(mode.inline_cache(key, offset, ways))
+ 
+class Feedback(Instruction):
+    
+    def __init__(self):
+        self.name = 'FEEDBACK'
+        self.inputs = [ 'value' ]
+        self.outputs = [ 'value' ]
+        self.__doc__ = ('Records the value on top of the stack, leaving it '
+            'there, in the feedback vector of the current function at this '
+            'instruction. Only tiered interpreters record values. '
+            'Compiled code may treat a value that is the only one recorded '
+            'as a constant, deoptimising if it sees another.')
+        
+    def process(self, mode):
+        mode.stack_push(mode.feedback(mode.stack_pop(gtypes.iptr)))
+ 
 class DropN(Instruction):
     
     def __init__(self):
@@ -1229,7 +1299,8 @@ def _init():
                PopState, IP, Zero, DropN, Symbol, FarJump, ZeroMemory, 
                GC_FreePointerStore, GC_FreePointerLoad, GC_Malloc_Fast, Drop,
                GC_LimitPointerStore, GC_LimitPointerLoad, Next_IP, PinnedObject,
-               GC_Allocate_Only, FullyInitialized, Lock, Unlock, Pin ]:
+               GC_Allocate_Only, FullyInitialized, Lock, Unlock, Pin,
+               GC_Split, Quicken, InlineCache, Feedback ]:
         i = cls()
         instructions[i.name] = i
     for x in (1,2,4):
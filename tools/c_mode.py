@@ -13,6 +13,42 @@ def default_name(index):
     
 _uid = 0
 
+# Set when the address of a frame slot is taken, so that references in the
+# frame may be written without marking the frame dirty.
+frame_escapes = False
+
+# Set while writing an interpreter that counts backward jumps in gvmt_tier.
+tier_counting = False
+
+def initial_frame_state():
+    if frame_escapes:
+        return 'GVMT_FRAME_ALWAYS_SCAN'
+    else:
+        return 'GVMT_FRAME_DIRTY'
+
+def write_frame_barrier(out):
+    if frame_escapes:
+        out << '#define GVMT_DIRTY_FRAME\n'
+    else:
+        out << ('#define GVMT_DIRTY_FRAME '
+                'FRAME_POINTER->gvmt_frame.scanned = GVMT_FRAME_DIRTY\n')
+
+def operand_table(state = 0):
+    'Name of the operand table for instructions entered with state cached items'
+    if state:
+        return 'gvmt_operand_table_c%d' % state
+    else:
+        return 'gvmt_operand_table'
+
+def dispatch(state = 0):
+    'C statement to dispatch the instruction at _gvmt_ip'
+    if common.direct_threading:
+        return ' goto *(void*)*_gvmt_ip;'
+    elif common.token_threading:
+        return ' goto *%s[*_gvmt_ip];' % operand_table(state)
+    else:
+        return ' break;'
+
 _return_type_codes = { 
     gtypes.i1 : 'RETURN_TYPE_I4',
     gtypes.i2 : 'RETURN_TYPE_I4',
@@ -247,6 +283,8 @@ class LAddr(Expr):
         self.name = name
         
     def __str__(self):
+        global frame_escapes
+        frame_escapes = True
         return '(&FRAME_POINTER->%s)' % self.name
         
     def indir(self, tipe):
@@ -254,7 +292,7 @@ class LAddr(Expr):
 
     def pstore(self, tipe, value, out):
         out << (' %s = %s; ' % (self.name, value))
-        out << (' FRAME_POINTER->%s = %s; ' % (self.name, self.name))
+        out << (' FRAME_POINTER->%s = %s; GVMT_DIRTY_FRAME;' % (self.name, self.name))
 
 class Constant(Simple):
     
@@ -591,6 +629,8 @@ class CMode(object):
                 #Size is build time constant
                 count = int(size)
                 if tipe == gtypes.r:
+                    global frame_escapes
+                    frame_escapes = True
                     ref_fmt = '(FRAME_POINTER->gvmt_frame.refs + %d)'
                     result = Simple(gtypes.p, ref_fmt % self.ref_temps_count)
                     self.ref_temps_count += count
@@ -661,8 +701,11 @@ class CMode(object):
     def gc_safe(self):
         # Uncache all references.
         self.in_regs = set()
-        self.out << ' if(gvmt_gc_waiting) gvmt_gc_safe_point'
-        self.out << '(gvmt_sp, (GVMT_Frame)FRAME_POINTER);'
+        if common.polling_safepoints:
+            self.out << ' GVMT_GC_POLL(gvmt_sp, (GVMT_Frame)FRAME_POINTER);'
+        else:
+            self.out << ' if(gvmt_gc_waiting) gvmt_gc_safe_point'
+            self.out << '(gvmt_sp, (GVMT_Frame)FRAME_POINTER);'
 
     def compound(self, name, qualifiers, graph):
         global _next_label
@@ -778,6 +821,11 @@ class CMode(object):
         if size == 4:
             ip = '(_gvmt_ip + %d)' % self.stream_offset
             self.stream_offset += 4
+            if common.direct_threading:
+                # One word per byte, so cannot load all four at once.
+                return Simple(gtypes.iptr, 
+                    '((%s[0] << 24) | (%s[1] << 16) | (%s[2] << 8) | %s[3])' 
+                    % (ip, ip, ip, ip))
             return Simple(gtypes.iptr, '_gvmt_fetch_4(%s)' % ip)
         while size:
             value = self.get()
@@ -814,23 +862,29 @@ class CMode(object):
         return self.stack.pop(tipe, self.out)
         
     def top_level(self, name, qualifiers, graph):
+        global frame_escapes
+        frame_escapes = False
         out = self.out
         self.out = common.Buffer()
         self.compound(name, qualifiers, graph)
         if self.ref_temps_max:
             out << '\n#define FRAME_POINTER (&gvmt_frame)\n'
+            write_frame_barrier(out)
             out << ' struct { struct gvmt_frame gvmt_frame; '
             out << 'GVMT_Object refs[%d]; } gvmt_frame;' % self.ref_temps_max
             out << ' gvmt_frame.gvmt_frame.previous = _gvmt_caller_frame;'
             out << ' gvmt_frame.gvmt_frame.count = %d;' % self.ref_temps_max
+            out << ' gvmt_frame.gvmt_frame.scanned = %s;' % initial_frame_state()
             for i in range(self.ref_temps_max):
                 out << ' gvmt_frame.gvmt_frame.refs[%d] = 0;' % i
         else:
             out << '\n#define FRAME_POINTER _gvmt_caller_frame\n'
+            out << '#define GVMT_DIRTY_FRAME\n'
         out << self.out
         self.out = out
         out.no_line()
         self.out << '#undef FRAME_POINTER\n'
+        self.out << '#undef GVMT_DIRTY_FRAME\n'
     
     def declarations(self, out):
         for name in self.stack.declarations:
@@ -961,7 +1015,7 @@ class CMode(object):
             self.names[index] = name
         self.out << ' %s = %s%s;' % (name, cast, value.cast(tipe))
         if index in self.mem_temps:
-            fmt = ' FRAME_POINTER->gvmt_frame.refs[%d] = (GVMT_Object)%s;'
+            fmt = ' FRAME_POINTER->gvmt_frame.refs[%d] = (GVMT_Object)%s; GVMT_DIRTY_FRAME;'
             self.out << fmt % (self.ref_base+self.mem_temps.index(index), name)
             self.in_regs.discard(index)
             
@@ -975,6 +1029,18 @@ class CMode(object):
     def far_jump(self, addr):
         raise _exception('Cannot use FAR_JUMP outside of intepreter context')
         
+    def quicken(self, opcode):
+        raise _exception('Cannot use QUICKEN outside of intepreter context')
+        
+    def inline_cache(self, key, offset, ways):
+        # No instruction to cache for, just load the target.
+        return Simple(gtypes.p, '(*(void**)(((char*)%s)+%s))' % 
+                      (key.cast(gtypes.p), offset))
+        
+    def feedback(self, value):
+        # Nowhere to record it.
+        return value
+        
     def stack_drop(self, offset, size):
         self.stack.drop(offset, size, self.out)
         
@@ -1098,9 +1164,12 @@ class CMode(object):
             
 class IMode(CMode):
 
-    def __init__(self, temp, externals, gc_name, name):
+    def __init__(self, temp, externals, gc_name, name, cached = 0):
         CMode.__init__(self, temp, externals, gc_name)
         self.i_name = name
+        # The top cached stack items are in gvmt_c0 (deepest) upwards.
+        for i in range(cached):
+            self.stack.push(StackItem('gvmt_c%d' % i), self.out)
 
     def top_level(self, name, qualifiers, graph):
         self.i_length = graph.deltas[0] + 1
@@ -1110,10 +1179,10 @@ class IMode(CMode):
         global _uid
         _uid += 1
         self.create_and_push_handler()
-        self.out << ' __handler_%d->ip = _gvmt_ip;' % _uid
+        self.out << ' __handler_%d->ip = (void*)_gvmt_ip;' % _uid
         c = self.setjump()
         self.out << ' __handler_%d = gvmt_exception_stack;' % _uid
-        self.out << ' _gvmt_ip = __handler_%d->ip;' % _uid
+        self.out << ' _gvmt_ip = (void*)__handler_%d->ip;' % _uid
         return c
 
     def ip(self):
@@ -1131,27 +1200,92 @@ class IMode(CMode):
     def far_jump(self, addr):
         self.out << ' _gvmt_ip = %s;' % addr.cast(gtypes.p)
         self.stack.flush_to_memory(self.out)
-        if common.token_threading:
-            self.out << ' goto *gvmt_operand_table[*_gvmt_ip];'
+        self.out << dispatch()
+        
+    def quicken(self, opcode):
+        if common.direct_threading:
+            self.out << (' *_gvmt_ip = (uintptr_t)gvmt_operand_table[%s];' % 
+                         opcode.cast(gtypes.iptr))
         else:
-            self.out << ' break;'
+            self.out << ' *_gvmt_ip = %s;' % opcode.cast(gtypes.iptr)
+            
+    def inline_cache(self, key, offset, ways):
+        if common.direct_threading:
+            # The compiler cannot find sites in threaded code.
+            return CMode.inline_cache(self, key, offset, ways)
+        global _uid
+        _uid += 1
+        self.out << (' void* gvmt_target_%d = gvmt_inline_cache_lookup('
+                     '_gvmt_ip, %s, %s, %s);' % (_uid, key.cast(gtypes.p),
+                     offset, ways))
+        return Simple(gtypes.p, 'gvmt_target_%d' % _uid)
+        
+    def feedback(self, value):
+        if not tier_counting:
+            # Only registered functions have feedback vectors.
+            return CMode.feedback(self, value)
+        global _uid
+        _uid += 1
+        self.out << (' intptr_t gvmt_feedback_%d = (intptr_t)gvmt_feedback_record('
+                     'gvmt_tier, _gvmt_ip, (uintptr_t)%s);' % (_uid, value))
+        return Simple(gtypes.iptr, 'gvmt_feedback_%d' % _uid)
        
-    def close(self):
+    def gc_safe(self):
+        # Cached stack items may be references, which the GC must see.
+        if common.stack_caching:
+            self.stack.flush_to_memory(self.out)
+        CMode.gc_safe(self)
+       
+    def close(self, cache = 0):
+        '''Ends the instruction, leaving up to cache stack items in gvmt_c0...
+        Returns the number of items left, the state for the next dispatch.'''
+        global _temp_index
         if self.stream_offset:
             self.out << ' _gvmt_ip += %d;' % self.stream_offset
         if self.stream_stack:
             raise _exception(
                   "Value(s) pushed back to stream at end of instruction")
         self.stream_offset = 0
+        cache = min(cache, len(self.stack.cache))
+        self.stack.flush_cache(self.out, cache)
+        # Evaluate everything before overwriting any gvmt_cN.
+        values = []
+        for value in self.stack.uncache():
+            if not isinstance(value, StackItem):
+                value = value.store(self.stack.declarations, self.out)
+            elif not value.txt.startswith('gvmt_r'):
+                _temp_index += 1
+                name = 'gvmt_r%d' % _temp_index
+                self.stack.declarations[name] = 'GVMT_StackItem'
+                self.out << ' %s = %s;' % (name, value)
+                value = StackItem(name)
+            values.append(value)
         self.stack.flush_to_memory(self.out)
+        for i, value in enumerate(values):
+            reg = StackItem('gvmt_c%d' % i).cast(value.tipe)
+            self.out << ' %s = %s;' % (reg, value)
+        return cache
 
     def jump(self, offset):
+        if tier_counting:
+            # The stack must be in memory for on-stack replacement.
+            self.stack.flush_to_memory(self.out)
+            global _uid
+            _uid += 1
+            target = 'gvmt_target_%d' % _uid
+            self.out << ' if ((int16_t)(%s) < 0 && gvmt_tier) {' % offset
+            self.out << ' uint8_t* %s = _gvmt_ip + (int16_t)(%s);' % (target, offset)
+            self.out << ' gvmt_funcptr gvmt_osr_%d;' % _uid
+            self.out << ' GVMT_TIER_BACK_EDGE(gvmt_tier, %s);' % target
+            self.out << ' gvmt_osr_%d = GVMT_TIER_OSR_CODE(gvmt_tier, %s);' % (_uid, target)
+            self.out << ' if (gvmt_osr_%d) {' % _uid
+            # Compiled code copies the locals from the interpreter frame.
+            self.out << ' gvmt_sp[-1].p = &gvmt_frame; gvmt_sp -= 1;'
+            self.out << ' return gvmt_osr_%d(gvmt_sp, _gvmt_caller_frame);' % _uid
+            self.out << ' } }'
         self.out << ' _gvmt_ip += (int16_t)(%s);' % offset 
         self.stack.flush_to_memory(self.out)
-        if common.token_threading:
-            self.out << ' goto *gvmt_operand_table[*_gvmt_ip];'
-        else:
-            self.out << ' break;'
+        self.out << dispatch()
         
     def alloca(self, tipe, size):
         global _uid
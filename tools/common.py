@@ -4,9 +4,40 @@ import re, sys
 import os
 import StringIO
 
-legal_qualifiers = ( 'protected', 'private', 'nocomp', 'componly')
+legal_qualifiers = ( 'protected', 'private', 'nocomp', 'componly', 'super')
 global_debug = False
 token_threading = False
+# Direct threading implies token_threading: labels rather than a switch.
+direct_threading = False
+polling_safepoints = False
+profile_sequences = False
+# Opcode profiling: 1 counts opcodes and pairs, 2 also counts cycles.
+profile_opcodes = 0
+# Number of stack items kept in locals between instructions (0 to 3).
+stack_caching = 0
+# Count entries and backward jumps, for tiered compilation.
+tiered = False
+report_escapes = False
+
+def quickens(qualifiers):
+    '''Returns the name of the instruction quickened by an instruction with
+    these qualifiers, declared by the qualifier quick(name), or None.'''
+    for q in qualifiers:
+        if q.startswith('quick(') and q.endswith(')'):
+            return q[6:-1]
+    return None
+
+def cache_ways(qualifiers):
+    '''Returns the number of keys held by each inline cache of an instruction
+    with these qualifiers, declared by the qualifier cache(n), or None.'''
+    for q in qualifiers:
+        if q.startswith('cache(') and q.endswith(')') and q[6:-1].isdigit():
+            return int(q[6:-1])
+    return None
+
+def legal_qualifier(q):
+    return (q in legal_qualifiers or quickens([q]) is not None or
+            cache_ways([q]) is not None)
 
 class GVMTException(Exception): 
     
@@ -164,7 +164,7 @@ class CompoundInstruction(builtin.Instruction):
         self.opcode = opcode
         self.qualifiers = qualifiers
         for p in qualifiers:
-            if p not in common.legal_qualifiers:
+            if not common.legal_qualifier(p):
                 raise common.UnlocatedException("Unrecognised qualifier '%s'"%p)
         self.flow_graph = flow_graph.FlowGraph(instructions)
         top = end = 0
@@ -232,4 +232,13 @@ class CompoundInstruction(builtin.Instruction):
 
     def terminates_block(self):
         return self.flow_graph.ends_block()
+        
+    def members(self):
+        'The instructions a superinstruction is made of, in order'
+        result = []
+        for bb in self.flow_graph:
+            for i in bb:
+                if i.__class__ is CompoundInstruction:
+                    result.append(i)
+        return result
 
@@ -303,6 +303,15 @@ class DeltaMode(object):
     
     def far_jump(self, value):
         pass
+        
+    def quicken(self, opcode):
+        pass
+        
+    def inline_cache(self, key, offset, ways):
+        pass
+    
+    def feedback(self, value):
+        pass
     
     def push_current_state(self):
         pass
@@ -349,4 +358,48 @@ class DeltaMode(object):
     def unlock_internal(self, obj, offset):
         pass
     
-
+class _FirstCall(Exception):
+    pass
+    
+class _BeforeCallMode(DeltaMode):
+    "Stops at the first call"
+    
+    def _stop(self, *args):
+        raise _FirstCall()
+        
+    n_call = n_call_no_gc = call = c_call = _stop
+    
+def consume_before_call(graph):
+    '''Stack items consumed before the first call on any path, or Unknown.
+    Assumes no back edges, which are rare within instructions.'''
+    consume = graph.deltas[1]
+    if consume is not Unknown:
+        return consume
+    consume = 0
+    # Stack offset at the end of each block, or None after a call.
+    exits = {}
+    for bb in graph.nodes:
+        offsets = []
+        if bb.index == 0:
+            offsets.append(0)
+        for pred in bb.predecessors:
+            if pred not in exits:
+                return Unknown
+            if exits[pred] is not None:
+                offsets.append(exits[pred])
+        if not offsets:
+            exits[bb] = None
+            continue
+        mode = _BeforeCallMode()
+        mode.stack_offset = StackOffset(False, min(offsets))
+        try:
+            for i in bb:
+                i.process(mode)
+            exits[bb] = mode.stack_offset.value
+        except _FirstCall:
+            exits[bb] = None
+        if mode.stack_offset.absolute:
+            return Unknown
+        mode.set_consume()
+        consume = max(consume, mode.consume)
+    return consume
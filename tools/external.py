@@ -196,6 +196,15 @@ class ExternalMode(object):
     def far_jump(self, value):
         pass
         
+    def quicken(self, opcode):
+        pass
+        
+    def inline_cache(self, key, offset, ways):
+        pass
+        
+    def feedback(self, value):
+        pass
+        
     def target(self, index):
         pass
         
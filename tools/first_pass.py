@@ -222,6 +222,15 @@ class FirstPassMode(object):
     def far_jump(self, addr):
         self.out << '  end_of_block = true;\n'
         
+    def quicken(self, opcode):
+        pass
+        
+    def inline_cache(self, key, offset, ways):
+        pass
+        
+    def feedback(self, value):
+        pass
+        
     def gc_free_pointer_store(self, value):
         pass
     
@@ -289,6 +298,13 @@ _END = '''
     
 '''
            
+def superinstructions(bytecodes, inst):
+    '''Superinstructions starting with inst. The compiler treats them as inst, 
+    then compiles the remaining members in place, so that any of them may
+    start a block.'''
+    return [ s for s in bytecodes.instructions if 'super' in s.qualifiers and
+             s.members()[0].name == inst.name ]
+
 def first_pass(bytecodes, out):
     f_types = set()
     glbls = set()
@@ -306,6 +322,11 @@ def first_pass(bytecodes, out):
         mode.stack_flush()
         out << '}\n'
     for i in bytecodes.instructions:
+        if 'super' in i.qualifiers:
+            continue
+        if 'private' not in i.qualifiers:
+            for s in superinstructions(bytecodes, i):
+                out << '  case _gvmt_opcode_%s_%s:\n' % (bytecodes.func_name, s.name)
         if 'nocomp' in i.qualifiers:
             if 'private' not in i.qualifiers:
                 out << _NO_COMP % (bytecodes.func_name, i.name, i.name)
@@ -8,9 +8,11 @@ _safe = None
 _read_barrier = None
 _write_barrier = None
 _alloc_only = None
+_prezeroed = False
 
 def get_inline_inst(gc_name):
     global _allocate, _safe, _read_barrier, _write_barrier, _alloc_only
+    global _prezeroed
     dirname = os.path.dirname(sys.argv[0])
     infile = common.In(os.path.join(dirname, gc_name + '.gsc'))
     gsc_file = gsc.read(infile)
@@ -26,6 +28,10 @@ def get_inline_inst(gc_name):
             _read_barrier = i
         elif i.name == 'GC_WRITE_BARRIER':
             _write_barrier = i
+        elif i.name == 'GC_PREZEROED':
+            # Collector hands out pre-zeroed memory, 
+            # so GC_MALLOC need not initialise it.
+            _prezeroed = True
         else:
             print "Unexpected instruction '%s' in gc-inline file" % i.name
             sys.exit(1)
@@ -39,13 +45,17 @@ def gc_inline_section(gsc_section):
     for inst in gsc_section.instructions:
         for bb in inst.flow_graph:               
             for index, i in enumerate(bb.instructions):
-                if i.__class__ is builtin.GC_Malloc and _allocate:
+                if i.__class__ is builtin.GC_Malloc and _prezeroed and _alloc_only:
+                    bb[index] = _alloc_only
+                    inserted_alloc_only = True
+                elif i.__class__ is builtin.GC_Malloc and _allocate:
                     bb[index] = _allocate
                     inserted_allocate = True
                 elif i.__class__ is builtin.GC_Allocate_Only and _alloc_only:
                     bb[index] = _alloc_only
                     inserted_alloc_only = True
-                elif i.__class__ is builtin.GC_Safe and _safe:
+                elif (i.__class__ is builtin.GC_Safe and _safe and
+                      not common.polling_safepoints):
                     bb[index] = _safe
                     inserted_safe = True
                 elif i.__class__ is builtin.RLoad and i.tipe == gtypes.r and _read_barrier:
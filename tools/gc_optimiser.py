@@ -1,16 +1,243 @@
  
-import common, gsc, builtin, gtypes, graph, compound
+import sys, common, gsc, builtin, gtypes, graph, compound
 
 __GC_ALLOCATE = builtin.GC_Allocate_Only()
+__GC_MALLOC = builtin.GC_Malloc()
+__GC_SPLIT = builtin.GC_Split()
 __RSTORE_R = builtin.RStoreSimple(gtypes.r)
 
+# Must match GVMT_MAX_REGION_SIZE in gvmt.h
+MAX_REGION_SIZE = 1024
+
+_ALLOCATIONS = (builtin.GC_Malloc, builtin.GC_Split)
 
 def optimise_allocate(flow_graph):
+    'Returns the number of allocations removed.'
+    removed = scalar_replace(flow_graph, ssa_constants(flow_graph))
     consts = ssa_constants(flow_graph)
     equivalents = find_equivalents(flow_graph, consts)
 #    print "Equivalents", equivalents
     remove_write_barriers(flow_graph, equivalents)
     remove_redundant_initialisation(flow_graph, equivalents)
+    # Must come last, a coalesced allocation is only initialised 
+    # as a whole, so must not be treated as a single object.
+    coalesce_allocations(flow_graph, consts)
+    return removed
+
+def _constant_allocation(bb, index):
+    'Returns (size, temp, store index) for "size GC_MALLOC TSTORE(temp)"'
+    if index == 0 or bb[index-1].__class__ is not builtin.Number:
+        return None
+    store = index + 1
+    while (store < len(bb) and 
+           bb[store].__class__ in (builtin.Name, builtin.Comment, builtin.Line)):
+        store += 1
+    if store == len(bb) or bb[store].__class__ is not builtin.TStore:
+        return None
+    return bb[index-1].value, bb[store], store
+    
+# Fields of these types can be held in temporaries without changing values.
+_FIELD_TYPES = (gtypes.i4, gtypes.u4, gtypes.i8, gtypes.u8, 
+                gtypes.f4, gtypes.f8, gtypes.r, gtypes.p)
+
+def _zero(tipe):
+    'Instructions to push a zero of type tipe'
+    int_letter = 'I' if gtypes.p.size == 4 else 'L'
+    if tipe is gtypes.f4:
+        return [ builtin.Number('0'), builtin.instructions[int_letter + '2F'] ]
+    elif tipe is gtypes.f8:
+        return [ builtin.Number('0'), builtin.instructions[int_letter + '2D'] ]
+    elif tipe.size > gtypes.p.size:
+        return [ builtin.Number('0'), builtin.instructions['SIGN'] ]
+    else:
+        return [ builtin.Number('0') ]
+
+def _walk(node, parent, position, visit):
+    index, children = node
+    visit(index, parent, position)
+    for position, child in enumerate(children):
+        # Complex instructions have no child nodes.
+        if isinstance(child, list):
+            _walk(child, node, position, visit)
+    
+def _object_uses(graph, temps):
+    """Finds uses of temps, as the object of a load or store at a constant 
+    offset, or FULLY_INITIALIZED. Returns (uses, escaped), where uses is a 
+    list of (bb, index, temp) and escaped is the set of temps used otherwise."""
+    uses = []
+    escaped = set()
+    for bb in graph:
+        accepted = set()
+        def visit(index, parent, position):
+            inst = bb[index]
+            if inst.__class__ is not builtin.TLoad or inst.index not in temps:
+                return
+            if parent is None:
+                return
+            p_index = parent[0]
+            p_inst = bb[p_index]
+            if p_inst.__class__ is builtin.FullyInitialized:
+                if index != p_index-1:
+                    return
+            elif (p_inst.__class__ is builtin.RLoad or 
+                  p_inst.__class__ is builtin.RStore):
+                if (position != len(p_inst.inputs) - 2 or index != p_index-2 or
+                    bb[p_index-1].__class__ is not builtin.Number):
+                    return
+            else:
+                return
+            accepted.add(index)
+            uses.append((bb, p_index, inst.index))
+        for node in block_to_forest(bb):
+            _walk(node, None, 0, visit)
+        # Anything not accepted, including values left on the stack 
+        # at the end of the block, is an escape.
+        for index, inst in enumerate(bb):
+            if (inst.__class__ is builtin.TLoad and inst.index in temps and
+                index not in accepted):
+                escaped.add(inst.index)
+    return uses, escaped
+    
+def _max_temp(graph):
+    result = -1
+    for bb in graph:
+        for inst in bb:
+            if hasattr(inst, 'index') and isinstance(inst.index, int):
+                result = max(result, inst.index)
+    return result
+
+def scalar_replace(graph, consts):
+    """Replace objects that never escape with a temporary for each field.
+    Returns the number of allocations removed."""
+    allocations = {}
+    for bb in graph:
+        for index, inst in enumerate(bb):
+            # Temps modified after PUSH_CURRENT_STATE may not survive a RAISE.
+            if inst.__class__ is builtin.PushCurrentState:
+                return 0
+            if inst.__class__ is builtin.GC_Malloc:
+                alloc = _constant_allocation(bb, index)
+                if alloc is not None and alloc[1].index in consts:
+                    size, store, store_index = alloc
+                    allocations[store.index] = (bb, index, store_index, size)
+    if not allocations:
+        return 0
+    uses, escaped = _object_uses(graph, allocations)
+    fields = {}
+    for bb, index, t in uses:
+        inst = bb[index]
+        if inst.__class__ is builtin.FullyInitialized:
+            continue
+        offset = bb[index-1].value
+        if (inst.tipe not in _FIELD_TYPES or offset < 0 or 
+            offset + inst.tipe.size > allocations[t][3]):
+            escaped.add(t)
+            continue
+        f = fields.setdefault(t, {})
+        if f.get(offset, inst.tipe) is not inst.tipe:
+            escaped.add(t)
+        f[offset] = inst.tipe
+    for t, f in fields.items():
+        end = 0
+        for offset in sorted(f):
+            if offset < end:
+                # Overlapping fields
+                escaped.add(t)
+            end = offset + f[offset].size
+    replace = set(allocations) - escaped
+    if not replace:
+        return 0
+    next_temp = _max_temp(graph) + 1
+    temps = {}
+    for t in sorted(replace):
+        for offset in sorted(fields.get(t, {})):
+            temps[(t, offset)] = next_temp
+            next_temp += 1
+    # Rewrite each block from the end, so indices remain valid.
+    edits = {}
+    for bb, index, t in uses:
+        if t in replace:
+            edits.setdefault(bb, []).append((index, t))
+    for t in replace:
+        bb, index, store_index, size = allocations[t]
+        edits.setdefault(bb, []).append((index, t))
+    for bb, todo in edits.items():
+        todo.sort(reverse=True)
+        for index, t in todo:
+            inst = bb[index]
+            if inst.__class__ is builtin.GC_Malloc:
+                store_index = allocations[t][2]
+                for i in range(store_index, index-2, -1):
+                    kind = bb[i].__class__
+                    if kind is builtin.Name and bb[i].index != t:
+                        continue
+                    if kind is not builtin.Comment and kind is not builtin.Line:
+                        bb.pop(i)
+                init = []
+                for offset, tipe in sorted(fields.get(t, {}).items()):
+                    init += _zero(tipe)
+                    init.append(builtin.TStore(tipe, temps[(t, offset)]))
+                for i in reversed(init):
+                    bb.insert(index-1, i)
+            elif inst.__class__ is builtin.FullyInitialized:
+                bb.pop(index)
+                bb.pop(index-1)
+            else:
+                temp = temps[(t, bb[index-1].value)]
+                if inst.__class__ is builtin.RStore:
+                    bb[index] = builtin.TStore(inst.tipe, temp)
+                else:
+                    bb[index] = builtin.TLoad(inst.tipe, temp)
+                bb.pop(index-1)
+                bb.pop(index-2)
+    for bb in graph:
+        for index in range(len(bb)-1, -1, -1):
+            inst = bb[index]
+            if ((inst.__class__ is builtin.Name or 
+                 inst.__class__ is builtin.TypeName) and inst.index in replace):
+                bb.pop(index)
+    return len(replace)
+
+def _align(size):
+    return (size + gtypes.p.size - 1) & -gtypes.p.size
+    
+def coalesce_allocations(graph, consts):
+    'Merge allocations in the same block, with no GC-safe point between them.'
+    for bb in graph:
+        _coalesce_block(bb, consts)
+    
+def _coalesce_block(bb, consts):
+    # Index of first allocation of region, its temp and the region size.
+    region = None
+    index = 0
+    while index < len(bb):
+        inst = bb[index]
+        if (inst.__class__ is not builtin.GC_Malloc and 
+            inst.__class__ is not builtin.GC_Allocate_Only):
+            if inst.may_gc():
+                region = None
+            index += 1
+            continue
+        alloc = _constant_allocation(bb, index)
+        if alloc is None or alloc[1].index not in consts:
+            region = None
+            index += 1
+            continue
+        size, store, store_index = alloc
+        if region is None or region[2] + _align(size) >= MAX_REGION_SIZE:
+            region = [ index, store, _align(size) ]
+            index = store_index + 1
+            continue
+        first, first_store, offset = region
+        # Zero the whole region if either object needs it.
+        if inst.__class__ is builtin.GC_Malloc:
+            bb[first] = __GC_MALLOC
+        region[2] = offset + _align(size)
+        bb[first-1] = builtin.Number(str(region[2]))
+        bb[index-1] = builtin.TLoad(first_store.tipe, first_store.index)
+        bb[index] = builtin.Number(str(offset))
+        bb.insert(index+1, __GC_SPLIT)
+        index = store_index + 2
 
 def child_instruction(node, bb, index):
     obj_node = node[1][index]
@@ -231,7 +458,7 @@ def _local_barriers(bb, equivalents):
         if inst.__class__ is builtin.TStore and inst.index in equivalents:
             val_inst = child_instruction(node, bb, 0)
             if val_inst is not None:
-                if val_inst.__class__ is builtin.GC_Malloc:
+                if val_inst.__class__ in _ALLOCATIONS:
                     barriers |= equivalents[inst.index]
     return barriers
     
@@ -259,7 +486,7 @@ def _remove_barriers(bb, barriers, equivalents):
         if inst.__class__ is builtin.TStore and inst.index in equivalents:
             val_inst = child_instruction(node, bb, 0)
             if val_inst is not None:
-                if val_inst.__class__ is builtin.GC_Malloc:
+                if val_inst.__class__ in _ALLOCATIONS:
                     barriers = equivalents[inst.index]
 
 def pop(stack):
@@ -319,7 +546,9 @@ def ssa_constants(graph):
     
 def gc_optimise_section(gsc_section):
     for inst in gsc_section.instructions:
-        optimise_allocate(inst.flow_graph)              
+        removed = optimise_allocate(inst.flow_graph)              
+        if removed and common.report_escapes:
+            print >> sys.stderr, '%s: %d allocation(s) removed' % (inst.name, removed)
     
 def gc_optimise(gsc_file):
     if common.global_debug:
@@ -28,6 +28,9 @@ c_types = { 'object' : 'GVMT_Object',
             'string' : 'char[0]',
             'address' : 'void*'
             }      
+
+# Compiled frames hold one word for each local.
+_wide_types = { 'int64' : gtypes.i8, 'uint64' : gtypes.u8, 'float64' : gtypes.f8 }
     
 def get_type(cmpd):
     for i in cmpd.instructions:
@@ -74,17 +77,24 @@ def write_header(bytecodes, header):
                                                            names[i], i)
     header << 'extern char* gvmt_opcode_names_%s[];\n' % bytecodes.func_name
     header << 'extern int gvmt_opcode_lengths_%s[];\n' % bytecodes.func_name
+    header << 'extern uint8_t gvmt_generic_opcodes_%s[];\n' % bytecodes.func_name
 
 #    header << '#define  TOTAL_OPCODES %d\n' % count
 
-def emit_operand_table(bytecodes, out):
+def _state_suffix(state):
+    if state:
+        return '_c%d' % state
+    else:
+        return ''
+
+def emit_operand_table(bytecodes, out, state = 0):
     table = [ None ] * 256;
     out << '#undef L\n#define L(x) &&_gvmt_label_%s_##x\n' % bytecodes.func_name
     for i in bytecodes.instructions:
         if 'private' in i.qualifiers or 'componly'  in i.qualifiers:
             continue
-        table[i.opcode] = 'L(%s), ' % i.name
-    out << 'static void* gvmt_operand_table[] = { '
+        table[i.opcode] = 'L(%s%s), ' % (i.name, _state_suffix(state))
+    out << 'static void* %s[] = { ' % c_mode.operand_table(state)
     for i in range(256):
         if (i & 7) == 0:
             out << '\n    '
@@ -94,6 +104,99 @@ def emit_operand_table(bytecodes, out):
             out << table[i]
     out << '\n};\n#undef L\n'
 
+def _length(inst):
+    return inst.flow_graph.deltas[0] + 1
+
+def _write_lengths(bytecodes, out):
+    'Instruction lengths, by opcode, for walking over bytecodes'
+    lengths = [ 1 ] * 256
+    for i in bytecodes.instructions:
+        if 'private' in i.qualifiers or 'componly'  in i.qualifiers:
+            continue
+        lengths[i.opcode] = _length(i)
+    out << '    static uint8_t lengths[] = {'
+    for i in range(256):
+        if (i & 15) == 0:
+            out << '\n        '
+        out << '%d, ' % lengths[i]
+    out << '\n    };\n'
+
+def write_translator(bytecodes, name, out):
+    '''Translates bytecodes into direct-threaded code: one word per byte,
+    holding the label address for each opcode and the byte value for each
+    operand, so that jump offsets and instruction lengths are unchanged.'''
+    out << '\nuintptr_t* gvmt_threaded_code_%s(uint8_t* start, uint8_t* end) {\n' % name
+    _write_lengths(bytecodes, out)
+    out << '''    void** labels = (void**)%s(NULL, NULL);
+    uintptr_t* code = (uintptr_t*)malloc((end - start) * sizeof(uintptr_t));
+    uint8_t* ip = start;
+    while (ip < end) {
+        uintptr_t* word = code + (ip - start);
+        int i, length = lengths[*ip];
+        word[0] = (uintptr_t)labels[*ip];
+        for (i = 1; i < length && ip + i < end; i++)
+            word[i] = ip[i];
+        ip += length;
+    }
+    return code;
+}
+''' % name
+
+def write_superinstructions(bytecodes, name, out):
+    '''Rewrites bytecodes to use superinstructions, and back again.
+    Only the first opcode of a sequence is replaced, the remainder are
+    skipped over by the superinstruction.'''
+    supers = []
+    for i in bytecodes.instructions:
+        if 'super' in i.qualifiers:
+            supers.append(i)
+    # Longest first
+    supers.sort(key = lambda i : -len(i.members()))
+    out << '\nvoid gvmt_superinstructions_%s(uint8_t* start, uint8_t* end) {\n' % name
+    _write_lengths(bytecodes, out)
+    out << '    uint8_t* ip = start;\n'
+    out << '    while (ip < end) {\n'
+    out << '        switch(*ip) {\n'
+    firsts = []
+    for s in supers:
+        first = s.members()[0]
+        if first not in firsts:
+            firsts.append(first)
+    for first in firsts:
+        out << '        case %d: /* %s */\n' % (first.opcode, first.name)
+        for s in supers:
+            members = s.members()
+            if members[0] is not first:
+                continue
+            tests = [ 'end - ip >= %d' % _length(s) ]
+            offset = 0
+            for prev, m in zip(members, members[1:]):
+                offset += _length(prev)
+                tests.append('ip[%d] == %d' % (offset, m.opcode))
+            out << '            if (%s) {\n' % ' && '.join(tests)
+            out << '                *ip = %d; /* %s */\n' % (s.opcode, s.name)
+            out << '                ip += %d;\n' % _length(s)
+            out << '                continue;\n'
+            out << '            }\n'
+        out << '            break;\n'
+    out << '        }\n'
+    out << '        ip += lengths[*ip];\n'
+    out << '    }\n'
+    out << '}\n'
+    out << '\nvoid gvmt_remove_superinstructions_%s(uint8_t* start, uint8_t* end) {\n' % name
+    _write_lengths(bytecodes, out)
+    out << '    uint8_t* ip = start;\n'
+    out << '    while (ip < end) {\n'
+    out << '        switch(*ip) {\n'
+    for s in supers:
+        out << '        case %d: /* %s */\n' % (s.opcode, s.name)
+        out << '            *ip = %d;\n' % s.members()[0].opcode
+        out << '            break;\n'
+    out << '        }\n'
+    out << '        ip += lengths[*ip];\n'
+    out << '    }\n'
+    out << '}\n'
+
 def write_interpreter(bytecodes, out, gc_name):
     write_header(bytecodes, out);
     out << '''
@@ -104,6 +207,16 @@ uint32_t execution_count[256];
     preamble = Buffer()
     switch = Buffer()
     postamble = Buffer()
+    c_mode.frame_escapes = False
+    # Direct-threaded code does not start at the registered bytecodes.
+    tiered = (common.tiered and bytecodes.master and 
+              not common.direct_threading)
+    c_mode.tier_counting = tiered
+    if tiered:
+        for t, n in bytecodes.locals:
+            if t in _wide_types and _wide_types[t].size > gtypes.p.size:
+                raise UnlocatedException("Local '%s' of type %s is wider than "
+                            "a pointer, which -J does not support" % (n, t))
     l = len(bytecodes.locals)
     inserts = 0
     mode = ExternalMode()
@@ -128,6 +241,12 @@ uint32_t execution_count[256];
             enter_inst = i
         elif i.name == '__exit':
             exit_inst = i
+    # Interpreters with a postamble check the ip after every instruction,
+    # so gain little from stack caching.
+    if post_check or not common.token_threading:
+        caching = 0
+    else:
+        caching = common.stack_caching
     for i in bytecodes.instructions:
         if i.name == '__preamble':
             temp = Buffer()
@@ -171,20 +290,32 @@ uint32_t execution_count[256];
         preamble << temp
         preamble << '  }\n'
     if common.token_threading:
-        switch << '  goto *gvmt_operand_table[*_gvmt_ip];\n'
+        switch << ' %s\n' % c_mode.dispatch()
     else:
         switch << '  do {\n'
         switch << '  switch(*_gvmt_ip) {\n'
-    for i in bytecodes.instructions:
+    # One copy of each instruction for each number of cached stack items.
+    copies = [ (state, i) for state in range(caching + 1)
+                          for i in bytecodes.instructions ]
+    for state, i in copies:
         if 'private' in i.qualifiers or 'componly'  in i.qualifiers:
             continue
         if common.token_threading:
-            switch << '  _gvmt_label_%s_%s: ((void)0); ' % (bytecodes.func_name, i.name)
+            switch << '  _gvmt_label_%s_%s%s: ((void)0); ' % (bytecodes.func_name,
+                                                     i.name, _state_suffix(state))
         else:
             switch << '  case _gvmt_opcode_%s_%s: ' % (bytecodes.func_name, i.name)
         switch << ' /* Deltas %s %s %s */ ' % i.flow_graph.deltas
         switch << '{\n'
         switch << '#define GVMT_CURRENT_OPCODE _gvmt_opcode_%s_%s\n' % (bytecodes.func_name, i.name)
+        if common.profile_sequences and bytecodes.master:
+            switch << ('gvmt_profile_sequence(_gvmt_ip, _gvmt_ip + %d, '
+                       'GVMT_CURRENT_OPCODE, gvmt_opcode_names_%s);\n' % 
+                       (_length(i), bytecodes.func_name))
+        if common.profile_opcodes and bytecodes.master:
+            if common.profile_opcodes > 1:
+                switch << 'GVMT_TIME_OPCODE(gvmt_opcodes);\n'
+            switch << 'GVMT_COUNT_OPCODE(gvmt_opcodes, GVMT_CURRENT_OPCODE);\n'
 #        if enter_inst:
 #            switch << '{\n'
 #            temp = Buffer()
@@ -201,7 +332,7 @@ uint32_t execution_count[256];
 #            switch << temp
 #            switch << ' } \n'
         temp = Buffer()
-        mode = IMode(temp, externals, gc_name, bytecodes.func_name)
+        mode = IMode(temp, externals, gc_name, bytecodes.func_name, state)
         mode.stream_fetch() # Opcode
         if enter_inst:
             enter_inst.top_level(mode)
@@ -211,7 +342,7 @@ uint32_t execution_count[256];
         if max_refs < mode.ref_temps_max:
             max_refs = mode.ref_temps_max
         try:
-            mode.close()
+            next_state = mode.close(caching)
         except UnlocatedException, ex:
             raise UnlocatedException("%s in compound instruction '%s'" % (ex.msg, i.name))
         temp.close()
@@ -234,10 +365,7 @@ uint32_t execution_count[256];
 #            switch << ' } \n'
         if post_check:
             switch << 'if (_gvmt_ip >= gvmt_ip_end) goto gvmt_postamble;\n' 
-        if common.token_threading:
-            switch << ' } goto *gvmt_operand_table[*_gvmt_ip];\n'
-        else:
-            switch << ' } break;\n'
+        switch << ' }%s\n' % c_mode.dispatch(next_state)
         switch << '#undef GVMT_CURRENT_OPCODE\n'
     switch.close()
     out << '   struct gvmt_interpreter_frame { struct gvmt_frame gvmt_frame;\n'
@@ -255,33 +383,56 @@ uint32_t execution_count[256];
                 raise UnlocatedException("Unrecognised type '%s'" % t)
     out << '   };\n' 
     out << '#define FRAME_POINTER (&gvmt_frame)\n'
+    c_mode.write_frame_barrier(out)
     out << 'GVMT_CALL GVMT_StackItem* '
     if bytecodes.func_name:
         name = bytecodes.func_name
     else:
         name = 'gvmt_interpreter'
     out << ' %s(GVMT_StackItem* gvmt_sp, GVMT_Frame _gvmt_caller_frame) {' % name
+    if common.direct_threading:
+        ip_type = 'uintptr_t*'
+    else:
+        ip_type = 'uint8_t*'
     out << '''
-    register uint8_t* _gvmt_ip; 
+    register %s _gvmt_ip; 
 //    uint8_t* gvmt_ip_start;
-    _gvmt_ip = (uint8_t*)gvmt_sp[0].p;
 //    gvmt_ip_start = _gvmt_ip;
     GVMT_StackItem return_value;
-''' 
+''' % ip_type
     for t, n in bytecodes.locals:
         out << '   %s %s;\n' % (c_types[t], n)
     if common.token_threading:
-        emit_operand_table(bytecodes, out)
+        for state in range(caching + 1):
+            emit_operand_table(bytecodes, out, state)
+    if caching:
+        out << '   register GVMT_StackItem %s;\n' % ', '.join(
+            [ 'gvmt_c%d' % state for state in range(caching) ])
+    if common.direct_threading:
+        # Called with a NULL stack, by the translator, to get the labels.
+        out << '   if (gvmt_sp == NULL)\n'
+        out << '       return (GVMT_StackItem*)gvmt_operand_table;\n'
+    out << '   _gvmt_ip = (%s)gvmt_sp[0].p;\n' % ip_type
     if post_check:
-        out << '   uint8_t* gvmt_ip_end = (uint8_t*)gvmt_sp[1].p;\n'
+        out << '   %s gvmt_ip_end = (%s)gvmt_sp[1].p;\n' % (ip_type, ip_type)
+    if tiered:
+        out << '   struct gvmt_tier* gvmt_tier = gvmt_tier_enter(_gvmt_ip);\n'
     out << '   struct gvmt_interpreter_frame gvmt_frame;\n'
     out << '   gvmt_frame.gvmt_frame.previous = _gvmt_caller_frame;\n' 
     out << '   gvmt_frame.gvmt_frame.count = %d;\n' % (max_refs + ref_locals)
+    out << '   gvmt_frame.gvmt_frame.scanned = %s;\n' % c_mode.initial_frame_state()
     for i in range(max_refs):                       
         out << ' gvmt_frame.gvmt_frame.refs[%d] = 0;\n' % i
+    if common.profile_opcodes and bytecodes.master:
+        out << '   struct gvmt_opcode_profile* gvmt_opcodes = gvmt_opcode_profile;\n'
+        out << '   if (gvmt_opcodes == NULL)\n'
+        out << ('       gvmt_opcodes = gvmt_opcode_profile_start('
+                'gvmt_opcode_names_%s);\n' % bytecodes.func_name)
     for t, n in bytecodes.locals:
         if t == 'object':
             out << '   gvmt_frame.%s = 0;\n' % n
+    if tiered:
+        write_deopt_entry(bytecodes, max_refs, out)
     default = Buffer()
     if common.token_threading:
         default << '  _gvmt_label_%s_0: ' % bytecodes.func_name
@@ -300,6 +451,8 @@ uint32_t execution_count[256];
    }
 '''
     out << preamble
+    if tiered:
+        out << '  gvmt_deoptimised: ((void)0);\n'
     out << switch
     out << default
     out.no_line()
@@ -310,9 +463,18 @@ uint32_t execution_count[256];
     out.no_line()
     out << '} /* End */\n'
     out << '#undef FRAME_POINTER\n'
+    out << '#undef GVMT_DIRTY_FRAME\n'
+    if common.direct_threading:
+        write_translator(bytecodes, name, out)
+    if bytecodes.master:
+        write_superinstructions(bytecodes, name, out)
     if bytecodes.master:
         out << 'uintptr_t gvmt_interpreter_%s_locals = %d;\n' % (bytecodes.func_name, l)
         out << 'uintptr_t gvmt_interpreter_%s_locals_offset = %d;\n' % (bytecodes.func_name, max_refs)
+        if tiered:
+            out << 'gvmt_funcptr gvmt_interpreter_%s_deopt = %s;\n' % (bytecodes.func_name, name)
+        else:
+            out << 'gvmt_funcptr gvmt_interpreter_%s_deopt = 0;\n' % bytecodes.func_name
     if bytecodes.master:
         write_offset(bytecodes, out)
         out << '\nchar *gvmt_opcode_names_%s[] = {' % bytecodes.func_name
@@ -342,6 +504,42 @@ uint32_t execution_count[256];
             else:
                 out << '    0,\n'
         out << '};\n'
+        # Maps quickened opcodes back to their generic opcode.
+        generic = range(256)
+        for i in bytecodes.instructions:
+            if common.quickens(i.qualifiers):
+                generic[i.opcode] = bytecodes.idict[common.quickens(i.qualifiers)].opcode
+        out << '\nuint8_t gvmt_generic_opcodes_%s[] = {' % bytecodes.func_name
+        for i in range(256):
+            if (i & 15) == 0:
+                out << '\n    '
+            out << '%d, ' % generic[i]
+        out << '\n};\n'
+
+def write_deopt_entry(bytecodes, max_refs, out):
+    '''Compiled code that deoptimises calls the interpreter with NULL, ip_end,
+    ip, its frame and the start of its bytecodes on the stack, above the 
+    stack it had at ip. The locals are copied from the compiled frame, which 
+    holds one word for each, objects first, and the preamble is skipped.
+    The resumed interpreter continues with the tier of the compiled code, 
+    which discards that code, so that it is recompiled with new feedback.'''
+    out << '   if (_gvmt_ip == NULL) {\n'
+    out << '       struct gvmt_frame* gvmt_deopt_frame = (struct gvmt_frame*)gvmt_sp[3].p;\n'
+    out << '       _gvmt_ip = (uint8_t*)gvmt_sp[2].p;\n'
+    out << '       gvmt_tier = gvmt_tier_deoptimise((uint8_t*)gvmt_sp[4].p, _gvmt_ip);\n'
+    out << '       gvmt_sp += 5;\n'
+    slot = max_refs
+    for t, n in bytecodes.locals:
+        if t == 'object':
+            out << '       gvmt_frame.%s = %s = gvmt_deopt_frame->refs[%d];\n' % (n, n, slot)
+            slot += 1
+    for t, n in bytecodes.locals:
+        if t != 'object':
+            out << ('       gvmt_frame.%s = %s = *(%s*)(gvmt_deopt_frame->refs + %d);\n' %
+                    (n, n, c_types[t], slot))
+            slot += 1
+    out << '       goto gvmt_deoptimised;\n'
+    out << '   }\n'
 
 def _write_func(inst, out, externals, gc_name, signature = None):
     buf = Buffer()
@@ -622,10 +820,17 @@ options = {
     'l' : 'Output GSO suitable for library code, no bytecode, root or heap sections allowed',
     'm memory_manager' : 'Memory manager (garbage collector) used',
     'T' : 'Use token-threading dispatch',
+    'D' : 'Use direct-threading dispatch, on code from gvmt_threaded_code_<name>()',
+    'P' : 'Use polling-page safe points (single load, no branch)',
+    'E' : 'Report allocations removed by escape analysis',
+    'S' : 'Profile instruction sequences, for superinstructions (gvmtic -p)',
+    'Q n' : 'Profile opcodes (see gvmt/native.h). 1 counts opcodes and pairs, 2 also counts cycles',
+    'C n' : 'Keep the top n (1 to 3) stack items in locals between instructions. Implies -T',
+    'J' : 'Count entries and backward jumps, for tiered compilation (see gvmt/compiler.h)',
 }       
 
 if __name__ == '__main__':    
-    opts, args = getopt.getopt(sys.argv[1:], 'ho:lgO:H:m:T')
+    opts, args = getopt.getopt(sys.argv[1:], 'ho:lgO:H:m:TPEDSC:Q:J')
     if not args:
         common.print_usage(options)
         sys.exit(1)
@@ -642,6 +847,24 @@ if __name__ == '__main__':
                 library = True
             elif opt == '-T':
                 common.token_threading = True
+            elif opt == '-D':
+                common.direct_threading = True
+                common.token_threading = True
+            elif opt == '-P':
+                common.polling_safepoints = True
+            elif opt == '-E':
+                common.report_escapes = True
+            elif opt == '-S':
+                common.profile_sequences = True
+            elif opt == '-Q':
+                common.profile_opcodes = int(value)
+            elif opt == '-J':
+                common.tiered = True
+            elif opt == '-C':
+                common.stack_caching = int(value)
+                if common.stack_caching < 1 or common.stack_caching > 3:
+                    raise GVMTException("Stack caching depth must be 1 to 3")
+                common.token_threading = True
             elif opt == '-g':
                 common.global_debug = True
             elif opt == '-m':
@@ -650,6 +873,10 @@ if __name__ == '__main__':
                 sys_headers = value
             elif opt == '-O':
                 optimise = opt + value
+        if common.direct_threading and common.stack_caching:
+            raise GVMTException("Stack caching (-C) needs token threading, not -D")
+        if common.direct_threading and common.tiered:
+            raise GVMTException("Tiered compilation (-J) cannot be used with -D")
         src_file = gsc.read(In(args))
         src_file.make_unique()
         if gc_name != 'none':
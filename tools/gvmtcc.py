@@ -1,9 +1,9 @@
 #!/usr/bin/python
 import common
 import sys, gvmtas, getopt, gsc, gtypes, operators
-import builtin, ssa, gc_inliner, gc_optimiser
+import builtin, ssa, gc_inliner, gc_optimiser, compound
 from stacks import Stack, CachingStack
-from delta import Unknown
+from delta import Unknown, consume_before_call
 import os
 import first_pass
 from llvm_mode import LlvmPassMode
@@ -22,7 +22,8 @@ class Compiler : public BaseCompiler {
 PUBLIC = '''public:
     Compiler(void);
     void init_types(void);
-    Function* compile(uint8_t *begin, uint8_t *end, char* name, bool jit);
+    Function* compile(uint8_t *begin, uint8_t *end, char* name, bool jit, 
+                      uint8_t* osr_ip = 0);
     static Compiler* get_compiler(void);
 '''
 
@@ -35,7 +36,8 @@ Compiler* Compiler::get_compiler(void) {
     return compiler;
 }
  
-Function* Compiler::compile(uint8_t *begin, uint8_t *end, char* name, bool jit) {
+Function* Compiler::compile(uint8_t *begin, uint8_t *end, char* name, bool jit, 
+                            uint8_t* osr_ip) {
     if (jit)
         jitting = true;
     else
@@ -45,6 +47,10 @@ Function* Compiler::compile(uint8_t *begin, uint8_t *end, char* name, bool jit)
     int length = end - begin;
 //    fprintf(stderr, "First pass\\n");
     first_pass(length, starts);
+    // An OSR entry starts in the interpreter's frame, at a loop header.
+    osr_offset = osr_ip ? osr_ip - begin : -1;
+    if (osr_offset >= 0)
+        starts.push_back(osr_offset);
     current_function = Function::Create(Architecture::FUNCTION_TYPE, 
                                         GlobalValue::ExternalLinkage,
                                         name, module);
@@ -91,6 +97,8 @@ def preamble(bytecodes, out):
     out << HEADER
     #private methods
     for i in bytecodes.instructions:
+        if 'super' in i.qualifiers:
+            continue
         ops = i.flow_graph.deltas[0]
         formals = ', '.join(['int op%d' % j for j in range(ops)])
         out << '    bool compile_%s(%s);\n' % (i.name, formals)
@@ -128,9 +136,19 @@ def _compile_body(inst, out, name):
         out << ' return block_terminated;\n'
     out << '#undef GVMT_CURRENT_OPCODE\n'
 
+def unquicken(bytecodes):
+    'Quickened instructions are compiled as their generic instruction'
+    by_name = dict([ (i.name, i) for i in bytecodes.instructions ])
+    for index, i in enumerate(bytecodes.instructions):
+        generic = common.quickens(i.qualifiers)
+        if generic:
+            ins = [ by_name[generic] ]
+            bytecodes.instructions[index] = compound.CompoundInstruction(
+                                        i.name, i.opcode, i.qualifiers, ins)
+
 def functions(bytecodes, out):
     for i in bytecodes.instructions:
-        if 'nocomp' in i.qualifiers:
+        if 'nocomp' in i.qualifiers or 'super' in i.qualifiers:
             continue
         ops = i.flow_graph.deltas[0]
         formals = ', '.join(['int op%d' % j for j in range(ops)])
@@ -164,10 +182,13 @@ def constructor(bytecodes, out, gc_name):
 SECOND_PASS_INIT = '''
 extern uintptr_t gvmt_interpreter_%s_locals; 
 extern uintptr_t gvmt_interpreter_%s_locals_offset;
+extern gvmt_funcptr gvmt_interpreter_%s_deopt;
+extern "C" unsigned gvmt_frame_index(char* name);
   
 void Compiler::second_pass(int length) {
     IP = ip_start;
-    uint8_t* ip_end = ip_start + length;
+    ip_end = ip_start + length;
+    deopt_interpreter = gvmt_interpreter_%s_deopt;
     bool block_terminated = true;
     std::map<int, BasicBlock*>::iterator it = block_map.begin();    current_block = it->second;
     current_block = start_block;
@@ -224,13 +245,28 @@ L_ADDR = '''    laddr_%s  = GetElementPtrInst::Create(FRAME, _offset,
                                  "laddr_%s", current_block);
 '''
     
+def _reads_feedback(graph):
+    for bb in graph:
+        for i in bb:
+            if i.__class__ is builtin.Feedback:
+                return True
+            if (isinstance(i, compound.CompoundInstruction) and 
+                _reads_feedback(i.flow_graph)):
+                return True
+    return False
+    
+def _may_deoptimise(inst):
+    'Instructions that call through inline caches, or read feedback, may deoptimise.'
+    return (common.cache_ways(inst.qualifiers) is not None or
+            _reads_feedback(inst.flow_graph))
+    
 def second_pass(bytecodes, out):
     ref_locals_count = 0
     for t, n in bytecodes.locals:
         if t == 'object':
             ref_locals_count += 1  
     n = bytecodes.func_name
-    out << SECOND_PASS_INIT % (n, n, n, len(bytecodes.locals), n, ref_locals_count, n)
+    out << SECOND_PASS_INIT % (n, n, n, n, n, len(bytecodes.locals), n, ref_locals_count, n)
     out << '    stack->max_join_depth(stack_cache_size, current_block);\n'
     out << '    stack->join_depth = 0;\n'
     offset = 0
@@ -244,16 +280,27 @@ def second_pass(bytecodes, out):
             out << _OFFSET % offset
             offset += gtypes.p.size
             out << L_ADDR % (n, n)
+    out << '    if (osr_offset < 0) {\n'
     for i in bytecodes.instructions:
         if i.name == '__preamble':
-            out << '    compile___preamble();\n'
-    out << '    BranchInst::Create(it->second, current_block);\n'
+            out << '        compile___preamble();\n'
+    out << '        BranchInst::Create(it->second, current_block);\n'
+    out << '    } else {\n'
+    out << '        Value* interpreter_frame = osr_frame();\n'
+    for t, n in bytecodes.locals:
+        out << ('        osr_local(interpreter_frame, gvmt_frame_index((char*)"%s"), '
+                'laddr_%s, ltype_%s);\n' % (n, n, n))
+    out << '        BranchInst::Create(block_map[osr_offset], current_block);\n'
+    out << '    }\n'
     out << '    current_block = it->second;\n'
     out << ' clear_locals();'
     out << LOOP_START
     for i in bytecodes.instructions:
-        if 'private' in i.qualifiers or 'nocomp' in i.qualifiers:
+        if ('private' in i.qualifiers or 'nocomp' in i.qualifiers or
+            'super' in i.qualifiers):
             continue
+        for s in first_pass.superinstructions(bytecodes, i):
+            out << '  case _gvmt_opcode_%s_%s:\n' % (bytecodes.func_name, s.name)
         out << '  case _gvmt_opcode_%s_%s:\n' % (bytecodes.func_name, i.name)
         consume = i.flow_graph.deltas[1]
         if consume == Unknown:
@@ -263,7 +310,17 @@ def second_pass(bytecodes, out):
             out << '        if (stack->join_depth < 0) stack->join_depth = 0;\n' 
         ops = i.flow_graph.deltas[0]
         args = ', '.join(['IP[%d]' % (j+1) for j in range(ops)])
+        # Speculation stops at the first call, so only the inputs
+        # consumed before it need saving.
+        speculate = _may_deoptimise(i)
+        if speculate:
+            inputs = consume_before_call(i.flow_graph)
+            speculate = inputs != Unknown
+        if speculate:
+            out << '        deopt_point(%d);\n' % inputs
         out << '        block_terminated = compile_%s(%s);\n' % (i.name, args)
+        if speculate:
+            out << '        deopt_ip = 0;\n'
         out << '        IP += %d;\n' % (ops+1)
         produce = i.flow_graph.deltas[2]
         out << '        stack->join_depth += %d;\n' % produce
@@ -274,22 +331,41 @@ def second_pass(bytecodes, out):
     out << '}\n'
     
 EXTERN_C = '''
+// The compiler may also be run by the tiered compilation thread.
+static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+
 extern "C" {
     void* gvmt_compile_jit(uint8_t* begin, uint8_t* end, char* name) {
+        pthread_mutex_lock(&compile_lock);
         Compiler* c = Compiler::get_compiler();
         Function* f = c->compile(begin, end, name, true);
         void* result = c->jit_compile(f, name);
+        pthread_mutex_unlock(&compile_lock);
+        gvmt_last_return_type = RETURN_TYPE_P;
+        return result;
+    }
+    
+    void* gvmt_compile_osr(uint8_t* begin, uint8_t* end, uint8_t* entry, char* name) {
+        pthread_mutex_lock(&compile_lock);
+        Compiler* c = Compiler::get_compiler();
+        Function* f = c->compile(begin, end, name, true, entry);
+        void* result = c->jit_compile(f, name);
+        pthread_mutex_unlock(&compile_lock);
         gvmt_last_return_type = RETURN_TYPE_P;
         return result;
     }
     
     void gvmt_compile(uint8_t* begin, uint8_t* end, char* name) {
+        pthread_mutex_lock(&compile_lock);
         Compiler::get_compiler()->compile(begin, end, name, false);
+        pthread_mutex_unlock(&compile_lock);
         gvmt_last_return_type = RETURN_TYPE_V;
     }
     
     void gvmt_write_ir(void) {
+        pthread_mutex_lock(&compile_lock);
         Compiler::get_compiler()->write_ir();
+        pthread_mutex_unlock(&compile_lock);
     }
 }
 '''
@@ -328,6 +404,7 @@ if __name__ == '__main__':
     if gc_name != 'none':
         gc_optimiser.gc_optimise(src_file)
         gc_inliner.gc_inline(src_file, gc_name + "_llvm")
+    unquicken(src_file.bytecodes)
     preamble(src_file.bytecodes, out)
     constructor(src_file.bytecodes, out, gc_name)
     first_pass.first_pass(src_file.bytecodes, out)
@@ -11,7 +11,7 @@ import gsc, objects
 import driver
 import sys_compiler
 import parser, lex, common
-import gtypes
+import gtypes, builtin, compound
 
 #def _get_type(decl):
 #    t = decl.type
@@ -43,6 +43,9 @@ def _ip_fetch(c, location):
     else:
         assert "Impossible count" and False
         
+# GVMT_CACHE_WAYS in gvmt/internal/core.h
+MAX_CACHE_WAYS = 4
+        
 def _c_function(name, location, qualifiers, code, out, local_vars):
     out << c_line(location.line, location.file)
     if 'private' in qualifiers:
@@ -99,8 +102,25 @@ def _c_function(name, location, qualifiers, code, out, local_vars):
         out << '    %s = %s;\n' % (item.name.lstrip('#'), _ip_fetch(item.name.count('#'), item.location))
     for v in local_vars:
         out << '    (void)&%s;\n' % v.name
+    generic = common.quickens(qualifiers)
+    if generic:
+        if varargs:
+            raise GVMTException("%s: Quickened instruction '%s' cannot have variable inputs" % (location, name))
+        # Push the inputs back, so the generic instruction can be re-executed.
+        pushes = ''.join([ ' GVMT_PUSH(%s);' % item.name for item in inputs ])
+        out << ('#define GVMT_DEQUICKEN() do { GVMT_QUICKEN(%s);%s '
+                'gvmt_far_jump(gvmt_ip()); } while (0)\n' % (generic, pushes))
+    ways = common.cache_ways(qualifiers)
+    if ways is not None:
+        if ways < 1 or ways > MAX_CACHE_WAYS:
+            raise GVMTException("%s: Inline caches hold from 1 to %d keys" % (location, MAX_CACHE_WAYS))
+        out << '#define _gvmt_cache_ways %d\n' % ways
     out << c_line(code.start.line, code.start.file)
     out << code.code << '\n'
+    if generic:
+        out << '#undef GVMT_DEQUICKEN\n'
+    if ways is not None:
+        out << '#undef _gvmt_cache_ways\n'
     out << c_line(code.start.line, code.start.file)
     for item in code.stack.outputs:
         out << 'GVMT_PUSH(%s); ' % item.name 
@@ -110,9 +130,52 @@ def _c_function(name, location, qualifiers, code, out, local_vars):
     out << '}\n\n'
 
 
+def assign_quick_opcodes(instructions):
+    '''Quickened instructions, declared with the qualifier quick(generic),
+    and their generic instructions are referred to by opcode in C code,
+    so are given opcodes now, from 255 down.
+    Returns a dict mapping the names of quickened instructions to generics.'''
+    by_name = {}
+    used = set()
+    for i in instructions:
+        by_name[i.name] = i
+        if i.opcode is not None:
+            used.add(i.opcode)
+    generics = {}
+    for i in instructions:
+        generic = common.quickens(i.qualifiers)
+        if generic is None:
+            continue
+        if generic not in by_name:
+            raise GVMTException("%s: No instruction named '%s'" % (i.location, generic))
+        g = by_name[generic]
+        if common.quickens(g.qualifiers) or 'private' in g.qualifiers or 'private' in i.qualifiers:
+            raise GVMTException("%s: Cannot quicken '%s' to '%s'" % (i.location, generic, i.name))
+        generics[i.name] = generic
+    opcode = 255
+    for i in instructions:
+        if i.opcode is None and (i.name in generics or i.name in generics.values()):
+            while opcode in used:
+                opcode -= 1
+            if opcode == 0:
+                raise GVMTException("%s: Too many instructions" % i.location)
+            i.opcode = opcode
+            used.add(opcode)
+    return generics
+
+def _check_quickened(bytecodes, generics):
+    'Quickened instructions must look the same as their generics from outside'
+    for i in bytecodes.instructions:
+        if i.name in generics:
+            g = bytecodes.idict[generics[i.name]]
+            if i.flow_graph.deltas != g.flow_graph.deltas:
+                raise GVMTException("Quickened instruction '%s' has different "
+                                    "operands or stack effect to '%s'" % (i.name, g.name))
+
 def compile_instructions(int_ast, flags, lcc_dir, prefix = None):
     cpp = int_ast.directives
     variables = int_ast.locals
+    generics = assign_quick_opcodes(int_ast.instructions)
     c_insts = []
     gsc_insts = []
     stack_insts = []
@@ -145,6 +208,9 @@ def compile_instructions(int_ast, flags, lcc_dir, prefix = None):
     if prefix:
         out << prefix
     out << '\n'
+    for i in int_ast.instructions:
+        if i.name in generics or i.name in generics.values():
+            out << '#define _gvmt_quick_%s %d\n' % (i.name, i.opcode)
     if variables:
         out << 'struct __gvmt_bytecode_locals_t {\n' 
         for v in variables:
@@ -179,6 +245,7 @@ def compile_instructions(int_ast, flags, lcc_dir, prefix = None):
                 i.opcode = opcodes[i.name]
             if i.name in qualifiers:
                 i.qualifiers = qualifiers[i.name]
+        _check_quickened(gsc_file.bytecodes, generics)
     return gsc_file
     
 def get_output(opts):
@@ -198,7 +265,7 @@ def process_compound(inst):
     if inst.opcode is not None:
         code.append('=%d' % inst.opcode)
     for q in inst.qualifiers:
-        if q not in common.legal_qualifiers:
+        if not common.legal_qualifier(q):
             raise GVMTException("%s: Illegal qualifier '%s'" % (inst.location, q))
     if inst.qualifiers:
         code.append('[%s]' % ' ' .join(inst.qualifiers))
@@ -225,6 +292,87 @@ def process_compound(inst):
     code.append(';')
     return ''.join(code)
 
+def read_profile(name):
+    'Returns a list of (count, names) from a profile written by gvmtas -S'
+    sequences = []
+    for line in open(name):
+        items = line.split()
+        if not items or items[0][0] == '#':
+            continue
+        sequences.append((int(items[0]), items[1:]))
+    return sequences
+
+# Superinstructions keep the opcodes of all but their first member in place,
+# so that branches into the middle still work. But the instruction pointer 
+# remains at the start of the superinstruction.
+_NEVER = (builtin.Next_IP, builtin.Opcode)
+_NOT_AFTER_FIRST = (builtin.IP, builtin.Jump, builtin.FarJump, 
+                    builtin.PushCurrentState, builtin.PreFetch, 
+                    builtin.ImmediateAdd, builtin.Quicken)
+
+def _uses(inst, classes):
+    for bb in inst.flow_graph:
+        for i in bb:
+            if isinstance(i, classes):
+                return True
+            if i.__class__ is compound.CompoundInstruction and _uses(i, classes):
+                return True
+    return False
+    
+def _can_combine(insts):
+    for i in insts:
+        if 'super' in i.qualifiers or _uses(i, _NEVER):
+            return False
+    for i in insts[:-1]:
+        if i.terminates_block():
+            return False
+    for i in insts[1:]:
+        if _uses(i, _NOT_AFTER_FIRST):
+            return False
+    return True
+
+def add_superinstructions(bytecodes, profile, count):
+    '''Adds up to count superinstructions for the sequences in profile
+    that would save the most dispatches.'''
+    available = {}
+    explicit = set()
+    unassigned = 0
+    for i in bytecodes.instructions:
+        if 'private' in i.qualifiers or 'componly' in i.qualifiers:
+            continue
+        available[i.name] = i
+        if i.opcode is None:
+            unassigned += 1
+        elif i.opcode:
+            explicit.add(i.opcode)
+    free = 255 - len(explicit) - unassigned
+    candidates = []
+    for c, names in read_profile(profile):
+        candidates.append((c * (len(names) - 1), names))
+    candidates.sort(reverse = True)
+    for saved, names in candidates:
+        if count == 0 or free == 0:
+            break
+        name = '__'.join(names)
+        if name in bytecodes.idict:
+            continue
+        insts = []
+        for n in names:
+            if n in available:
+                insts.append(available[n])
+        if len(insts) != len(names) or not _can_combine(insts):
+            continue
+        qualifiers = [ 'super' ]
+        for i in insts:
+            if 'nocomp' in i.qualifiers and 'nocomp' not in qualifiers:
+                qualifiers.append('nocomp')
+        items = [ name, '[' ] + qualifiers + [ ']', ':', names[0] ]
+        for n in names[1:]:
+            items += [ '#@', 'DROP', n ]
+        items.append(';')
+        bytecodes.line(items)
+        count -= 1
+        free -= 1
 
 options = {
     'h' : "Print this help and exit",
@@ -235,12 +383,14 @@ options = {
     'b bytecode-header-file' : 'Specify bytecode header file',
     'n name' : 'Name of generated interpreter',
     'D symbol' : 'Define symbol in preprocessor',
-    'z' : 'Do not put gc-safe-points on backward edges'
+    'z' : 'Do not put gc-safe-points on backward edges',
+    'p profile' : 'Add superinstructions for the commonest sequences in profile (from gvmtas -S)',
+    's count' : 'Maximum number of superinstructions to add, default 16'
 }        
 
 
 if __name__ == '__main__':
-    opts, args = getopt.getopt(sys.argv[1:], 'avI:b:hzo:D:n:L:')
+    opts, args = getopt.getopt(sys.argv[1:], 'avI:b:hzo:D:n:L:p:s:')
     flags = []
     int_name = None
     if len(args) != 1:
@@ -250,6 +400,8 @@ if __name__ == '__main__':
         bytecode_h = None
         gc_safe = True
         lcc_dir = None
+        profile = None
+        supers = 16
         for opt, value in opts:
             if opt == '-h':
                 common.print_usage(options, 'interpreter-defn')
@@ -270,10 +422,16 @@ if __name__ == '__main__':
                 gc_safe = False
             elif opt == '-L':
                 self.lcc_dir = value
+            elif opt == '-p':
+                profile = value
+            elif opt == '-s':
+                supers = int(value)
         if gc_safe:
             flags.append('-Wf-xgcsafe')
         int_ast = parser.parse_interpreter(lex.Lexer(args[0]))
         gsc_file = compile_instructions(int_ast, flags, lcc_dir)
+        if profile:
+            add_superinstructions(gsc_file.bytecodes, profile, supers)
         if int_name:
             gsc_file.bytecodes.set_name(int_name)
         gsc_file.bytecodes.master = True
@@ -84,7 +84,17 @@ if __name__ == '__main__':
             else:
                 if i.name in int_instructions:
                     raise common.UnlocatedException("'%s' is not private in interpreter\n" % i.name)
+        supers = []
+        quickened = []
         for i in int_file.bytecodes.instructions:
+            if 'super' in i.qualifiers and i.name not in names:
+                # Superinstructions do whatever their members do.
+                supers.append(i)
+                continue
+            if common.quickens(i.qualifiers) and i.name not in names:
+                # Quickened instructions do whatever their generic does.
+                quickened.append(i)
+                continue
             if i.name not in names and 'private' not in i.qualifiers:
                 if explicit:
                     raise common.GVMTException("No explicit definition for %s" % i.name)
@@ -96,6 +106,21 @@ if __name__ == '__main__':
                 i = compound.CompoundInstruction(i.name, i.opcode, 
                                                  i.qualifiers, ins)
                 trans.bytecodes.instructions.append(i)
+        trans_instructions = {}
+        for i in trans.bytecodes.instructions:
+            trans_instructions[i.name] = i
+        for i in supers:
+            members = i.members()
+            ins = [ trans_instructions[members[0].name] ]
+            for m in members[1:]:
+                ins += [ builtin.instructions['#@'], builtin.instructions['DROP'],
+                         trans_instructions[m.name] ]
+            i = compound.CompoundInstruction(i.name, i.opcode, i.qualifiers, ins)
+            trans.bytecodes.instructions.append(i)
+        for i in quickened:
+            ins = [ trans_instructions[common.quickens(i.qualifiers)] ]
+            i = compound.CompoundInstruction(i.name, i.opcode, i.qualifiers, ins)
+            trans.bytecodes.instructions.append(i)
         if func_name:
             trans.bytecodes.set_name(func_name)
         o = gvmtic.get_output(opts)
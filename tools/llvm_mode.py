@@ -349,6 +349,25 @@ class LAddr(Expr):
     def pstore(self, tipe, value):
         return Expr.pstore(self, tipe, value)
        
+class CachedTarget(Expr):
+    "Target of an inline cache. Calls to it are direct, if possible."
+    
+    def __init__(self, cache):
+        Expr.__init__(self, gtypes.p)
+        self.cache = cache
+        
+    def __str__(self):
+        return 'cached_target(%s, current_block)' % self.cache
+        
+    def cached_call(self, func_type, cc, params, pcount, native = False):
+        return 'cached_call(%s, %s, %s, &%s[0], &%s[%s], %s)' % (self.cache, 
+                func_type, cc, params, params, pcount, str(native).lower())
+        
+    def n_call(self, tipe, ftypes, params, pcount, native = False):
+        func_type = 'PTR_FUNC_TYPE_%s%s' % (''.join(ftypes), tipe.suffix)
+        call = self.cached_call(func_type, 'CallingConv::C', params, pcount, native)
+        return Simple(tipe, call)
+       
 class Constant(Simple):
     
     def __init__(self, tipe, val):
@@ -485,6 +504,8 @@ class LlvmPassMode(object):
         self.block_terminated = False
         self.successor_block = None
         self.i_name = i_name
+        # Temps holding the target of an inline cache, so calls can use it.
+        self.cached_temps = {}
 
     def declarations(self, out):
         for k,v in self.decls.items():
@@ -492,6 +513,8 @@ class LlvmPassMode(object):
 
     def tload(self, tipe, index):
         tmp = 'tmp%d_%d' % (index, self.block.index)
+        if tmp in self.cached_temps:
+            return self.cached_temps[tmp]
         if tipe == gtypes.r:
             assert index in self.in_mem or index in self.in_regs
             if index in self.in_mem and index not in self.in_regs:
@@ -504,6 +527,10 @@ class LlvmPassMode(object):
         self.stack.store(self.out)
         tmp = 'tmp%d_%d' % (index, self.block.index)
         self.out << ' %s = %s;\n'% (tmp, value.cast(tipe))
+        if isinstance(value, CachedTarget) and tipe == gtypes.p:
+            self.cached_temps[tmp] = value
+        else:
+            self.cached_temps.pop(tmp, None)
         if tipe == gtypes.r:
             self.in_regs.add(index)
             if index in self.mem_temps:
@@ -540,6 +567,7 @@ class LlvmPassMode(object):
     
     def pstore(self, tipe, array, value):
         self.stack.store(self.out)
+        self._side_effect()
         self.out << array.pstore(tipe, value)
         
     def rload(self, tipe, obj, offset):
@@ -559,6 +587,7 @@ class LlvmPassMode(object):
         
     def rstore(self, tipe, obj, offset, value):
         self.stack.store(self.out)
+        self._side_effect()
         if tipe == gtypes.r:
             self.out << ' gc_write(%s, %s, %s, current_block);\n' % (obj, offset, value.cast(tipe))
         else:
@@ -609,6 +638,7 @@ class LlvmPassMode(object):
         global _uid
         _uid += 1        
         self.stack.flush_to_memory(self.out)
+        self._side_effect()
         pinned = ' Value *pinned_%d;\n' % _uid
         args_fmt = ' Value *args_%d[] = { %s, 0 };\n'
         self.out << args_fmt % (_uid, value.cast(gtypes.r))
@@ -637,6 +667,14 @@ class LlvmPassMode(object):
                 self.in_mem.add(i)
         self.in_regs = set()
   
+    def _may_collect(self):
+        'The GC may move objects in the stack saved for deoptimisation'
+        self.out << ' deopt_ip = 0;\n'
+        
+    def _side_effect(self):
+        'Deoptimisation re-runs the whole instruction, so stop speculating'
+        self.out << ' deopt_ip = 0;\n'
+  
     def n_call(self, func, tipe, args, gc = True):
         global _uid
         _uid += 1
@@ -646,11 +684,15 @@ class LlvmPassMode(object):
         for a in self.n_args:
             self.out << '%s, ' % a
         self.out << ' 0};\n '
+        if isinstance(func, CachedTarget):
+            return self._cached_n_call(func, tipe, args, gc)
+        self._side_effect()
         a = func.n_call(tipe, self.n_types, 'nargs_%d' % _uid, args)
         self.n_types = []
         self.n_args = []
         if gc:
             self.stack.flush_to_memory(self.out)
+            self._may_collect()
             self.out << ' CallInst::Create(Architecture::ENTER_NATIVE, &NO_ARGS[0], &NO_ARGS[0], "", current_block);\n'
         result = Simple(tipe, 'freturn_%d' % _uid)
         self.out << ' Value* freturn_%d = %s;' % (_uid, a)
@@ -658,6 +700,22 @@ class LlvmPassMode(object):
             self.out << ' CallInst::Create(Architecture::EXIT_NATIVE, &NO_ARGS[0], &NO_ARGS[0], "", current_block);\n'
         return result
         
+    def _cached_n_call(self, func, tipe, args, gc):
+        # The guards, which may deoptimise, come before the call and before
+        # entering native mode, so stop speculating only after the call.
+        if gc:
+            self.stack.flush_to_memory(self.out)
+        a = func.n_call(tipe, self.n_types, 'nargs_%d' % _uid, args, gc)
+        self.n_types = []
+        self.n_args = []
+        self.out << ' Value* freturn_%d = %s;' % (_uid, a)
+        self.out << ' bb%s_%d = current_block;\n' % (self.label, self.block.index)
+        if gc:
+            self._may_collect()
+        else:
+            self._side_effect()
+        return Simple(tipe, 'freturn_%d' % _uid)
+        
     def n_call_no_gc(self, func, tipe, args):
         return self.n_call(func, tipe, args, False)
         
@@ -681,9 +739,17 @@ class LlvmPassMode(object):
         self.stack.flush_to_memory(self.out)
         self.out << ' Value *params_%d[] = { stack->get_pointer(current_block), FRAME };\n' % _uid, 
         params = 'params_%d' % _uid
+        if isinstance(func, CachedTarget):
+            call = func.cached_call('Architecture::POINTER_FUNCTION_TYPE',
+                                    common.llvm_cc(), params, 2)
+            self.out << ' Value *%s = %s;\n' % (c, call)
+            self.out << ' bb%s_%d = current_block;\n' % (self.label, self.block.index)
+            self._may_collect()
+            return c
         call = func.call(params, tipe, 2)
         self.out << ' CallInst *%s = %s;\n' % (c, call)
         self.out << ' %s->setCallingConv(%s);\n' % (c, common.llvm_cc())
+        self._may_collect()
         return c 
         
     def laddr(self, name):
@@ -705,6 +771,7 @@ class LlvmPassMode(object):
     def gc_malloc(self, size):
         self.stack.flush_to_memory(self.out)
         self._save_all()
+        self._may_collect()
         return Simple(gtypes.r, 'gc_malloc(%s, current_block)' % size)
        
     def gc_malloc_fast(self, size):
@@ -723,6 +790,7 @@ class LlvmPassMode(object):
     def gc_safe(self):
         self._save_all()
         self.stack.flush_to_memory(self.out)
+        self._may_collect()
         self.out << ' CallInst::Create(Architecture::GC_SAFE_POINT, &NO_ARGS[0], &NO_ARGS[0], "", current_block);\n'
                             
     def compound(self, name, qualifiers, graph):
@@ -921,7 +989,8 @@ class LlvmPassMode(object):
         return self.stack.pop(tipe, self.out)
     
     def stack_push(self, value):
-        if value.__class__ is not Constant and value.__class__ is not LAddr:
+        if (value.__class__ is not Constant and value.__class__ is not LAddr
+            and value.__class__ is not CachedTarget):
             global _uid
             _uid += 1
             self.out << ' sv_%d = %s;\n' % (_uid, value)
@@ -1010,6 +1079,29 @@ class LlvmPassMode(object):
         
     def far_jump(self, addr):
         raise common.UnlocatedException("FAR_JUMP is not allowed in compiled code")
+        
+    def quicken(self, opcode):
+        # Compiled code never reads the bytecode again.
+        pass
+        
+    def inline_cache(self, key, offset, ways):
+        global _uid
+        _uid += 1
+        try:
+            offset = offset.const()
+        except Exception:
+            raise common.UnlocatedException("INLINE_CACHE offset must be a constant")
+        self.out << ' InlineCache cache_%d(IP, %s, %s);\n' % (_uid, 
+                    key.cast(gtypes.p), offset)
+        return CachedTarget('cache_%d' % _uid)
+        
+    def feedback(self, value):
+        global _uid
+        _uid += 1
+        self.out << ' Value* feedback_%d = feedback(%s);\n' % (_uid, 
+                    value.cast(gtypes.iptr))
+        self.out << ' bb%s_%d = current_block;\n' % (self.label, self.block.index)
+        return Simple(gtypes.iptr, 'feedback_%d' % _uid)
        
     def push_current_state(self):
         global _uid
@@ -1078,6 +1170,7 @@ class LlvmPassMode(object):
         pass
        
     def lock(self, lock):
+        self._side_effect()
         self.out << ' Value *params_%d[] = { stack->get_pointer(current_block), FRAME };\n' % _uid, 
         params = 'params_%d' % _uid
         self.out << ' Value *func = module->getOrInsertFunction("gvmt_save_pointers", TYPE_P, TYPE_P, NULL);'
@@ -1085,13 +1178,16 @@ class LlvmPassMode(object):
         self.out << ' lock(%s, current_block);' % lock.cast(gtypes.p)
     
     def unlock(self, lock):
+        self._side_effect()
         self.out << ' unlock(%s, current_block);' % lock.cast(gtypes.p)
        
     def lock_internal(self, obj, offset):
+        self._side_effect()
         self.out << ' lock_internal(%s, %s, current_block);' % (
             obj.cast(gtypes.r), offset.cast(gtypes.i4))
     
     def unlock_internal(self, obj, offset):
+        self._side_effect()
         self.out << ' unlock_internal(%s, %s, current_block);' % (
             obj.cast(gtypes.r), offset.cast(gtypes.i4))
 
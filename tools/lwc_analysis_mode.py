@@ -237,6 +237,15 @@ class LwcAnalysisMode(object):
         self.farjumps = True
         self.stack = []
         
+    def quicken(self, opcode):
+        pass
+        
+    def inline_cache(self, key, offset, ways):
+        self.dont_compile = True
+        
+    def feedback(self, value):
+        self.dont_compile = True
+        
     def push_current_state(self):
         self.stack = []
         
@@ -342,6 +342,10 @@ class LWC_CompilerMode(object):
         self.out << 'add_far_jump(code, %s);\n' % addr
         self.out << 'code = emit_jump(code);\n'
         
+    def quicken(self, opcode):
+        # Compiled code never reads the bytecode again.
+        pass
+        
     def push_current_state(self):
         self.out << 'add_call(code, gvmt_push_current_state);\n'
         self.out << 'free_register(gvmt_lwc_return_register);\n'
@@ -256,11 +256,21 @@ def _parse_qualifiers(lexer):
         _syntax_error(t, "'['")
     t = lexer.next_token()
     while t.kind != lex.RBRACKET:
-        if t.kind == lex.NAME:
-            qualifiers.append(t.text)
-        else:
+        if t.kind != lex.NAME:
             _syntax_error(t, "a name")
+        qualifier = t.text
         t = lexer.next_token()
+        # Qualifiers may take a single name or number, as in quick(name)
+        if t.kind == lex.LPAREN:
+            t = lexer.next_token()
+            if t.kind != lex.NAME and t.kind != lex.NUMBER:
+                _syntax_error(t, "a name or number")
+            qualifier += '(%s)' % t.text
+            t = lexer.next_token()
+            if t.kind != lex.RPAREN:
+                _syntax_error(t, "')'")
+            t = lexer.next_token()
+        qualifiers.append(qualifier)
     return qualifiers
             
 def _parse_local(lexer):
@@ -71,6 +71,13 @@ class CachingStack(Stack):
     def flush_to_memory(self, out, retain = 0):
         self.flush_cache(out, retain)
         self.backing.flush_to_memory(out)
+
+    def uncache(self):
+        'Removes the cached values, without storing them, and returns them'
+        result = self.cache
+        self.cache = []
+        self._cache_size = 0
+        return result
         
     def join(self, out):
         self.flush_cache(out)